@@ -31,6 +31,15 @@
 #include <SoftwareSerial.h>
 #endif
 
+#ifdef RASPBERRYPI
+#include <sys/stat.h>
+#include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#define PASSWORD_EVENT -203 // decodeEvent()'s value for password events before finishEvent() checked them
+
 #ifndef F // check to see if F() macro is missing -- should not be triggered but...
 #error MOVI 1.10 and higher requires the F() macro.
 #endif
@@ -53,6 +62,20 @@
 #endif
 #endif
 
+#ifdef RASPBERRYPI
+// Resolves the training cache name: empty disables the cache, an absolute path is used as is and anything else
+// is taken relative to $XDG_CACHE_HOME, or ~/.cache if that isn't set.
+static String cachePath(const char *name)
+{
+    if (name[0]==0 || name[0]=='/') return String(name);
+    const char *base=getenv("XDG_CACHE_HOME");
+    if (base!=NULL && base[0]=='/') return String(base)+"/"+name;
+    base=getenv("HOME");
+    if (base==NULL || base[0]==0) return String("");
+    return String(base)+"/.cache/"+name;
+}
+#endif
+
 MOVI::MOVI()
 {
     usehardwareserial=false;
@@ -88,9 +111,51 @@ void inline MOVI::construct(int rx, int tx, bool debugonoff)
 {
     debug=debugonoff;
     shieldinit=0;
+    boottime=0;
+    resync();
     passstring="";
-    response="";
-    result="";
+    result[0]=0;
+    eventtime=0;
+    sentencehandlers=NULL;
+    sentencehandlerslots=0;
+    eventhandlers=NULL;
+    eventhandlerslots=0;
+    otherhandler=NULL;
+    droppedlines=0;
+    oversizedlines=0;
+    responsetimedout=false;
+    resetParser();
+    for (int i=0; i<MOVI_COMMAND_QUEUE; i++) commands[i].handle=0;
+    firstcommand=1;
+    nextcommand=1;
+    commandfailures=0;
+    ackwindow=MOVI_ACK_WINDOW;
+    outstanding=0;
+    sentencesacked=0;
+    sentencefailures=0;
+    failedlist=NULL;
+    failedbase=0;
+#ifdef RASPBERRYPI
+    const char *cache=getenv("MOVI_TRAINING_CACHE");
+    if (cache==NULL) cache=MOVI_TRAINING_CACHE;
+    trainingcachepath=cachePath(cache);
+    trainingcache=trainingcachepath.length() ? trainingcachepath.c_str() : NULL;
+    pendingsentences="";
+    callsignname="";
+    queuehead=0;
+    queuetail=0;
+    readerrunning=false;
+    phrases=NULL;
+    phrasecount=0;
+    phraseslots=0;
+    phraseindex=NULL;
+    phraseindexslots=0;
+    sentenceids=NULL;
+    sentencecount=0;
+    sentenceidslots=0;
+    resultevent=SHIELD_IDLE;
+    resultid=0;
+#endif
     intraining=false;
     firstsentence=true;
     callsigntrainok=true;
@@ -98,6 +163,7 @@ void inline MOVI::construct(int rx, int tx, bool debugonoff)
     #if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO_ARCH_PIC32)
         if (!usehardwareserial) {
             mySerial=new SoftwareSerial(rx, tx);
+            ackwindow=1; // SoftwareSerial can't receive while it sends, acknowledgments would get garbled
         }
     #else
         if (!usehardwareserial) {
@@ -143,85 +209,119 @@ void MOVI::init(bool waitformovi)
         }
         
         shieldinit=1;
-        while (waitformovi && !isReady()) {
-            delay(10);
+        drainInput(); // boot messages and answers meant for an earlier run of the sketch
+        unsigned long start=millis();
+        unsigned long wait=MOVI_BOOT_PROBE;
+        bool reprobed=false;
+        // A booting MOVI ignores INIT, so the probe is repeated, less often the longer it takes.
+        while (!probeBoot(waitformovi ? wait : MOVI_RESPONSE_TIMEOUT)) {
+            if (!waitformovi) return; // isReady() tells when MOVI is there
+            if (millis()-start>=MOVI_BOOT_TIMEOUT) {
+                if (debug) Serial.println(F("MOVI did not answer"));
+                return;
+            }
+            if (wait<MOVI_BOOT_PROBE_MAX) wait=wait*2<MOVI_BOOT_PROBE_MAX ? wait*2 : MOVI_BOOT_PROBE_MAX;
+            reprobed=true;
         }
- 
+        // The banner might have answered an earlier probe, so the answers to the later ones can still be on
+        // their way and must not be taken for the answer of the next command. MOVI answers in order, so they
+        // have all arrived once the answer to a PING has.
+        if (reprobed && !syncAnswers(MOVI_RESPONSE_TIMEOUT)) return;
+        boottime=millis()-start;
+        shieldinit=100;
+        if (debug) {
+            Serial.print(F("MOVI ready after "));
+            Serial.print(boottime);
+            Serial.println(F(" ms"));
+        }
+    }
+}
 
-        String sresponse="";
-        do {
-            mySerial->println(F("INIT"));
-            delay(10);
-            sresponse=getShieldResponse();
-        } while (sresponse.indexOf("@")==-1);
-            
-        int s=sresponse.indexOf(": ");
-        String ver=sresponse.substring(s+2);
-        
-        // toFloat() didn't work for me. Ugly workarounds working around further bugs follow!
-        #ifdef __ARDUINO_X86__ // Intel can't do .c_str() either!
-        char carray[ver.length() + 1];
-        ver.toCharArray(carray, sizeof(carray));
-        firmwareversion = atof(carray);
-        #else                 // AVR, SAM, SAMD, PIC32
-        firmwareversion=atof(ver.c_str());
-        #endif
-        s=sresponse.indexOf("@");
-        ver=sresponse.substring(s+1);
-        #ifdef __ARDUINO_X86__   // Intel
-        char c2array[ver.length() + 1];
-        ver.toCharArray(c2array, sizeof(c2array));
-        hardwareversion = atof(c2array);
-        #else                    // AVR, Sam, PIC32, SAMD
-        hardwareversion=atof(ver.c_str());
-        #endif
+void MOVI::drainInput()
+{
+    while (mySerial->available()) parseChar((char) mySerial->read()); // thrown away on purpose, not counted
+    resetParser();
+}
+
+bool MOVI::probeBoot(unsigned long timeout)
+{
+    mySerial->println(F("INIT"));
+    if (!skipBanner(timeout)) return false;
+    // The version banner looks like "MOVIEvent[...]: <firmware>@<hardware>"
+    firmwareversion=atof(strstr(linebuf, ": ")+2);
+    hardwareversion=atof(strchr(linebuf, '@')+1);
+    return true;
+}
+
+bool MOVI::syncAnswers(unsigned long timeout)
+{
+    mySerial->println(F("PING"));
+    unsigned long start=millis();
+    unsigned long waited=0;
+    while (readLine(timeout-waited)) {
+        if (strstr(linebuf, "PONG")) return true; // everything before it answered earlier probes
+        waited=millis()-start;
+        if (waited>=timeout) break;
+    }
+    return false;
+}
+
+bool MOVI::skipBanner(unsigned long timeout)
+{
+    unsigned long start=millis();
+    unsigned long waited=0;
+    while (readLine(timeout-waited)) {
+        if (strstr(linebuf, ": ") && strchr(linebuf, '@')) return true; // anything else is left over from booting
+        waited=millis()-start;
+        if (waited>=timeout) break;
     }
+    return false;
 }
 
 signed int MOVI::poll()
 {
+    if (outstanding>0) collectAcks(0); // sentences sent without train() must not show up as events
     firstsentence=false; // We assume loop() and we can't train in loop.
     intraining=false;
-  
-    int curchar;
-    int eventno;
-    while (mySerial->available()) {
-        curchar=mySerial->read();
-        if (curchar=='\n') {
-            if (debug) {
-                Serial.println(response);
-            }
-            if (response.lastIndexOf("MOVIEvent[")>=0) { // Dylan-suggested fix that makes sure buffer junk is not interpreted
-                eventno=response.substring(response.indexOf("[")+1,response.indexOf("]:")).toInt();
-                result=response.substring(response.indexOf(" ")+1);
-                if (eventno<100) { // then it's a user-read-only event
-                    response="";
-                    return SHIELD_IDLE;
-                }
-                if (eventno==202) {
-                    result=response.substring(response.indexOf("#")+1);
-                    response="";
-                    return result.toInt()+1; // Sentences returned start at 0,
-                                             // we make it easier for non-programmers and start at 1.
-                }
-                if (eventno==203) { // this is a password event
-                    response="";
-                    result.trim();
-                    if (passstring.equals(result)) {
-                        return PASSWORD_ACCEPT;
-                    } else {
-                        return PASSWORD_REJECT;
-                    }
-                }
-                response="";
-                return -eventno;
-            } else {
-                // other jibberish not belonging to MOVI
+    return readEvent();
+}
+
+signed int MOVI::readEvent()
+{
+#ifdef RASPBERRYPI
+    while (queuehead!=__atomic_load_n(&queuetail, __ATOMIC_ACQUIRE)) { // events from the reader thread come first
+        EventRecord *record=&eventqueue[queuehead%MOVI_EVENT_QUEUE];
+        signed int event=record->event;
+        if (event==SHIELD_IDLE || (event<0 && answerCommand(-event, record->result))) { // answered while waiting
+            __atomic_store_n(&queuehead, queuehead+1, __ATOMIC_RELEASE);
+            continue;
+        }
+        strcpy(result, record->result);
+        eventtime=record->time;
+        __atomic_store_n(&queuehead, queuehead+1, __ATOMIC_RELEASE);
+        return finishEvent(event);
+    }
+    if (readerrunning) {
+        expireCommands();
+        if (debug) {
+            while (Serial.available()) {
+                 mySerial->write(Serial.read());
             }
-        } else {
-            response+=(char) curchar;
         }
+        return SHIELD_IDLE;
+    }
+#endif
+    while (mySerial->available()) {
+        if (!parseChar((char) mySerial->read())) continue;
+        if (!eventline) {
+            if (linecontent) countLine(&droppedlines); // noise, a wrong baud rate or MOVI booting
+            continue;
+        }
+        if (answerCommand(parseeventno, answerText())) continue;
+        eventtime=micros();
+        return finishEvent(decodeEvent(result));
     }
+    expireCommands();
 
     if (debug) {
         while (Serial.available()) {
@@ -232,76 +332,573 @@ signed int MOVI::poll()
     return SHIELD_IDLE;
 }
 
+unsigned long MOVI::getEventTime()
+{
+    return eventtime;
+}
+
+void MOVI::countLine(unsigned long *counter)
+{
+#ifdef RASPBERRYPI
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+#else
+    (*counter)++;
+#endif
+}
+
+// Both are only counted by whoever parses MOVI's output, the reader thread if it is running.
+unsigned long MOVI::getDroppedLines()
+{
+#ifdef RASPBERRYPI
+    return __atomic_load_n(&droppedlines, __ATOMIC_RELAXED);
+#else
+    return droppedlines;
+#endif
+}
+
+unsigned long MOVI::getOversizedLines()
+{
+#ifdef RASPBERRYPI
+    return __atomic_load_n(&oversizedlines, __ATOMIC_RELAXED);
+#else
+    return oversizedlines;
+#endif
+}
+
+// Stores handler at index, growing the table with cleared slots as needed.
+static bool setHandler(MOVIHandler **table, unsigned int *slots, unsigned int index, MOVIHandler handler)
+{
+    if (index>=*slots) {
+        if (handler==NULL) return true;
+        MOVIHandler *grown=(MOVIHandler *) realloc(*table, (index+1)*sizeof(MOVIHandler));
+        if (grown==NULL) return false;
+        memset(grown+*slots, 0, (index+1-*slots)*sizeof(MOVIHandler));
+        *table=grown;
+        *slots=index+1;
+    }
+    (*table)[index]=handler;
+    return true;
+}
+
+bool MOVI::onSentence(int sentence, MOVIHandler handler)
+{
+    if (sentence<1) return false;
+    return setHandler(&sentencehandlers, &sentencehandlerslots, sentence-1, handler);
+}
+
+bool MOVI::onEvent(signed int event, MOVIHandler handler)
+{
+    if (event>-100 || event<-999) return false; // MOVI's event numbers have three digits
+    return setHandler(&eventhandlers, &eventhandlerslots, -event-100, handler);
+}
+
+void MOVI::onOther(MOVIHandler handler)
+{
+    otherhandler=handler;
+}
+
+signed int MOVI::dispatch()
+{
+    signed int event=poll();
+    MOVIHandler handler=NULL;
+    
+    if (event==SHIELD_IDLE) return event;
+    if (event>0) {
+        if ((unsigned int) event<=sentencehandlerslots) handler=sentencehandlers[event-1];
+    } else if ((unsigned int) (-event-100)<eventhandlerslots) {
+        handler=eventhandlers[-event-100];
+    }
+    if (handler==NULL) handler=otherhandler;
+    if (handler!=NULL) handler(event, result, strlen(result));
+    return event;
+}
+
+void MOVI::resetParser()
+{
+    linelen=0;
+    linebuf[0]=0;
+    parsestate=PARSE_PREFIX;
+    prefixpos=0;
+    eventline=false;
+    linedone=false;
+    linecontent=false;
+    lineoverflow=false;
+    parseeventno=0;
+    parsesentenceno=0;
+    payloadstart=0;
+    sentencestart=-1;
+}
+
+bool MOVI::parseChar(char c)
+{
+    static const char eventprefix[] = "MOVIEvent[";
+    static const int numbermax = 100000; // MOVI's event and sentence numbers stay far below, more digits is junk
+    
+    if (linedone) resetParser();
+    if (c=='\n') {
+        linebuf[linelen]=0;
+        linedone=true;
+        if (lineoverflow) countLine(&oversizedlines);
+#ifdef RASPBERRYPI
+        if (debug && !readerrunning) { // the reader thread must not write to Serial behind loop()'s back
+#else
+        if (debug) {
+#endif
+            Serial.println(linebuf);
+        }
+        // Anything without "MOVIEvent[" (eventline is false) is jibberish not belonging to MOVI. Dylan-suggested
+        // fix that makes sure buffer junk is not interpreted. Whoever drops such a line counts it.
+        return true;
+    }
+    if (linelen<MOVI_LINE_MAX) linebuf[linelen++]=c; // overlong lines are still parsed, only their result is cut
+    else lineoverflow=true;
+    if (!isspace((unsigned char) c)) linecontent=true;
+    
+    switch (parsestate) {
+        case PARSE_PREFIX:
+            if (c==eventprefix[prefixpos]) {
+                prefixpos++;
+                if (eventprefix[prefixpos]==0) {
+                    eventline=true;
+                    parsestate=PARSE_EVENTNO;
+                }
+            } else {
+                prefixpos=(c==eventprefix[0]) ? 1 : 0;
+            }
+            break;
+        case PARSE_EVENTNO:
+            if (c>='0' && c<='9') {
+                parseeventno=parseeventno*10+(c-'0');
+                if (parseeventno>=numbermax) {
+                    eventline=false;
+                    parsestate=PARSE_REJECT;
+                }
+                break;
+            }
+            parsestate=PARSE_SEPARATOR;
+            // fall through: the character ending the number might already be the separator
+        case PARSE_SEPARATOR:
+            if (c==' ') {
+                payloadstart=linelen;
+                parsestate=PARSE_PAYLOAD;
+            }
+            break;
+        case PARSE_PAYLOAD:
+            if (c=='#' && sentencestart<0) {
+                sentencestart=linelen;
+                parsestate=PARSE_SENTENCENO;
+            }
+            break;
+        case PARSE_SENTENCENO:
+            if (c>='0' && c<='9') {
+                parsesentenceno=parsesentenceno*10+(c-'0');
+                if (parsesentenceno<numbermax) break;
+                if (parseeventno==202) { // a recognized sentence with a bogus number
+                    eventline=false;
+                    parsestate=PARSE_REJECT;
+                } else parsestate=PARSE_PAYLOAD; // only 202 uses the number
+            } else parsestate=PARSE_PAYLOAD;
+            break;
+        case PARSE_REJECT: // the rest of the line is ignored
+            break;
+    }
+    return false;
+}
+
+// Copies len characters into result, cutting leading and trailing whitespace if requested.
+static void copyResult(char *result, const char *from, unsigned int len, bool trim)
+{
+    if (trim) {
+        while (len>0 && isspace((unsigned char) *from)) {
+            from++;
+            len--;
+        }
+        while (len>0 && isspace((unsigned char) from[len-1])) len--;
+    }
+    memcpy(result, from, len);
+    result[len]=0;
+}
+
+signed int MOVI::decodeEvent(char *out)
+{
+    int eventno=parseeventno;
+    unsigned int from=(parsestate>=PARSE_PAYLOAD) ? payloadstart : 0;
+    
+    if (eventno==202) {                      // a sentence was recognized
+        if (sentencestart>=0) from=sentencestart;
+        if (from>linelen) from=linelen;
+        copyResult(out, linebuf+from, linelen-from, false);
+        return parsesentenceno+1; // Sentences returned start at 0,
+                           // we make it easier for non-programmers and start at 1.
+    }
+    if (from>linelen) from=linelen;
+    copyResult(out, linebuf+from, linelen-from, eventno==203);
+    if (eventno<100) { // then it's a user-read-only event
+        return SHIELD_IDLE;
+    }
+    return -eventno;
+}
+
+signed int MOVI::finishEvent(signed int event)
+{
+#ifdef RASPBERRYPI
+    resultevent=event;
+    resultid=-1;
+#endif
+    if (event==PASSWORD_EVENT) { // this is a password event
+        if (passstring.equals(result)) {
+            return PASSWORD_ACCEPT;
+        } else {
+            return PASSWORD_REJECT;
+        }
+    }
+    return event;
+}
+
 String MOVI::getResult()
 {
-    return result;
+    return String(result);
+}
+
+#ifdef RASPBERRYPI
+StringView MOVI::getResultView()
+{
+    return StringView(result, strlen(result));
+}
+
+// Uppercases phrase and drops leading, trailing and repeated whitespace, the way MOVI writes its results.
+// Writes at most MOVI_LINE_MAX characters and a NUL to out.
+static void normalizePhrase(const char *phrase, char *out)
+{
+    unsigned int len=0;
+    bool space=false;
+    for (; *phrase; phrase++) {
+        unsigned char c=*phrase;
+        if (isspace(c)) {
+            space=len>0;
+            continue;
+        }
+        if (len+space>=MOVI_LINE_MAX) break;
+        if (space) out[len++]=' ';
+        space=false;
+        out[len++]=toupper(c);
+    }
+    out[len]=0;
+}
+
+// 32 bit FNV-1a
+static unsigned int hashPhrase(const char *phrase)
+{
+    unsigned int hash=2166136261U;
+    while (*phrase) {
+        hash^=(unsigned char) *phrase++;
+        hash*=16777619U;
+    }
+    return hash;
+}
+
+unsigned int MOVI::findPhrase(const char *phrase, unsigned int hash)
+{
+    unsigned int mask=phraseindexslots-1;
+    unsigned int slot=hash&mask;
+    while (phraseindex[slot]!=0 && strcmp(phrases[phraseindex[slot]-1], phrase)!=0) slot=(slot+1)&mask;
+    return slot;
+}
+
+int MOVI::lookupPhrase(const char *phrase)
+{
+    if (phrasecount==0) return 0;
+    char normal[MOVI_LINE_MAX+1];
+    normalizePhrase(phrase, normal);
+    return phraseindex[findPhrase(normal, hashPhrase(normal))];
+}
+
+int MOVI::intern(const char *phrase)
+{
+    char normal[MOVI_LINE_MAX+1];
+    normalizePhrase(phrase, normal);
+    unsigned int hash=hashPhrase(normal);
+    if (phrasecount>0) {
+        unsigned int id=phraseindex[findPhrase(normal, hash)];
+        if (id!=0) return id;
+    }
+    if (phrasecount==phraseslots) {
+        unsigned int slots=phraseslots ? phraseslots*2 : 16;
+        char **grown=(char **) realloc(phrases, slots*sizeof(char *));
+        if (grown==NULL) return 0;
+        phrases=grown;
+        phraseslots=slots;
+    }
+    if ((phrasecount+1)*2>phraseindexslots) { // rehash into a table twice the size
+        unsigned int slots=phraseindexslots ? phraseindexslots*2 : 32;
+        unsigned int *grown=(unsigned int *) calloc(slots, sizeof(unsigned int));
+        if (grown==NULL) return 0;
+        free(phraseindex);
+        phraseindex=grown;
+        phraseindexslots=slots;
+        for (unsigned int i=0; i<phrasecount; i++) {
+            phraseindex[findPhrase(phrases[i], hashPhrase(phrases[i]))]=i+1;
+        }
+    }
+    char *copy=strdup(normal);
+    if (copy==NULL) return 0;
+    phrases[phrasecount++]=copy;
+    phraseindex[findPhrase(copy, hash)]=phrasecount;
+    return phrasecount;
+}
+
+int MOVI::getResultId()
+{
+    if (resultid<0) {
+        if (resultevent>0) { // sentences come as their number, the id is the one of the added sentence
+            resultid=(unsigned int) resultevent<=sentencecount ? sentenceids[resultevent-1] : 0;
+        } else {
+            resultid=lookupPhrase(result);
+        }
+    }
+    return resultid;
+}
+
+const char *MOVI::getPhrase(int id)
+{
+    if (id<1 || (unsigned int) id>phrasecount) return NULL;
+    return phrases[id-1];
 }
 
-String MOVI::getShieldResponse()
+void MOVI::addSentenceId(const char *sentence)
 {
-    String resp="";
-    int curchar;
+    if (sentencecount==sentenceidslots) {
+        unsigned int slots=sentenceidslots ? sentenceidslots*2 : 16;
+        int *grown=(int *) realloc(sentenceids, slots*sizeof(int));
+        if (grown==NULL) return;
+        sentenceids=grown;
+        sentenceidslots=slots;
+    }
+    sentenceids[sentencecount++]=intern(sentence);
+}
+#endif
+
+void MOVI::waitSerial(unsigned long timeout)
+{
+#ifdef RASPBERRYPI
+    // select() on the port returns as soon as MOVI's answer arrives instead of after the next delay() tick
+    ((HardwareSerial *)mySerial)->waitAvailableTimeout(timeout>60000 ? 60000 : timeout>0 ? timeout : 1);
+#else
+    mySerial->flush();
+    delay(1);
+#endif
+}
+
+String MOVI::getShieldResponse(unsigned long timeout)
+{
+    responsetimedout=false;
     if (shieldinit==0) {
         init();
         return "";
     }
+#ifdef RASPBERRYPI
+    if (readerrunning) return ""; // the reader thread owns MOVI's output
+#endif
+    unsigned long start=millis();
+    unsigned long waited=0;
     while (shieldinit>0) {
-        mySerial->flush();
         while (mySerial->available()) {
-            curchar=mySerial->read();
-            if (curchar=='\n') {
-                if (resp=="") continue;
-                return resp;
-            } else {
-                resp+=(char) curchar;
-            }
+            // parsed into linebuf, so junk without a newline can't grow the response beyond MOVI_LINE_MAX
+            if (parseChar((char) mySerial->read()) && linelen>0) return String(linebuf);
         }
-        delay(10);
+        if (waited>=timeout) break;
+        waitSerial(timeout-waited);
+        waited=millis()-start;
     }
+    responsetimedout=true;
+    if (debug) Serial.println(F("MOVI didn't answer in time."));
     return "";
 }
 
-bool MOVI::sendCommand(String command, String parameter, String okresponse)
+bool MOVI::timedOut()
 {
+    return responsetimedout;
+}
+
+bool MOVI::sendCommand(String command, String parameter, String okresponse, unsigned long timeout)
+{
+    collectAcks(0); // the next response must not be a sentence acknowledgment
+    drainCommands(); // nor the answer to an earlier sendCommandAsync()
     if (isReady()) {
-        mySerial->println(command+" "+parameter+"\n");
+        mySerial->print(command); // printed piece by piece, the serial port coalesces them without a String copy
+        mySerial->print(" ");
+        mySerial->print(parameter);
+        mySerial->println("\n");
+#ifdef RASPBERRYPI
+        if (readerrunning) return true; // responses only show up as events now
+#endif
         if (okresponse=="") return true;
-        if (getShieldResponse().indexOf(okresponse)>=0) {
+        if (getShieldResponse(timeout).indexOf(okresponse)>=0) {
             return true;
         } else return false;
     } else return false;
 }
 
-bool MOVI::sendCommand(const __FlashStringHelper* command, const __FlashStringHelper* parameter, String okresponse)
+bool MOVI::sendCommand(const __FlashStringHelper* command, const __FlashStringHelper* parameter, String okresponse, unsigned long timeout)
 {
+    collectAcks(0); // the next response must not be a sentence acknowledgment
+    drainCommands(); // nor the answer to an earlier sendCommandAsync()
     if (isReady()) {
         mySerial->print(command);
         mySerial->print(" ");
         mySerial->print(parameter);
         mySerial->println("\n");
+#ifdef RASPBERRYPI
+        if (readerrunning) return true; // responses only show up as events now
+#endif
         if (okresponse=="") return true;
-        if (getShieldResponse().indexOf(okresponse)>=0) {
+        if (getShieldResponse(timeout).indexOf(okresponse)>=0) {
             return true;
         } else return false;
     } else return false;
 }
 
+// MOVI's own events: listening, speaking, recognition and 5xx warnings. Everything else it sends from 100 on
+// answers a command.
+static bool answersCommand(int eventno)
+{
+    if (eventno<100 || eventno>=500) return false;
+    if (eventno==140 || eventno==141 || eventno==150 || eventno==151) return false;
+    return eventno<200 || eventno>203;
+}
+
+unsigned int MOVI::sendCommandAsync(const char *command, const char *parameter, const char *okresponse,
+                                    unsigned long timeout)
+{
+    collectAcks(0); // answers of sentences come first
+    expireCommands();
+    while (nextcommand-firstcommand>=MOVI_COMMAND_QUEUE) waitCommand(); // make room by waiting for the oldest
+    if (!isReady()) return 0;
+    mySerial->print(command);
+    if (parameter!=NULL) {
+        mySerial->print(" ");
+        mySerial->print(parameter);
+    }
+    mySerial->println("\n");
+    PendingCommand *pending=&commands[nextcommand%MOVI_COMMAND_QUEUE];
+    pending->handle=nextcommand;
+    pending->status=COMMAND_PENDING;
+    pending->okresponse=okresponse;
+    pending->sent=millis();
+    pending->timeout=timeout;
+    return nextcommand++;
+}
+
+int MOVI::commandStatus(unsigned int handle)
+{
+    expireCommands();
+    if (handle==0 || handle>=nextcommand) return COMMAND_UNKNOWN;
+    if (handle>=firstcommand) return COMMAND_PENDING;
+    PendingCommand *done=&commands[handle%MOVI_COMMAND_QUEUE];
+    return done->handle==handle ? done->status : COMMAND_UNKNOWN;
+}
+
+int MOVI::waitCommands()
+{
+    drainCommands();
+    int failures=commandfailures;
+    commandfailures=0;
+    return failures;
+}
+
+void MOVI::drainCommands()
+{
+    while (firstcommand!=nextcommand) waitCommand();
+}
+
+void MOVI::waitCommand()
+{
+#ifdef RASPBERRYPI
+    if (!readerrunning) {
+        while (mySerial->available()) { // into the reader thread's queue, where poll() finds the events later
+            if (parseChar((char) mySerial->read())) pushEvent(micros());
+        }
+    }
+    answerQueued();
+    expireCommands();
+    if (readerrunning) delay(1);
+    else waitSerial(1);
+#else
+    if (readEvent()==SHIELD_IDLE) delay(1); // no room to keep events
+#endif
+}
+
+const char *MOVI::answerText()
+{
+    return parsestate>=PARSE_PAYLOAD && payloadstart<=linelen ? linebuf+payloadstart : "";
+}
+
+// Whether an answer means okresponse, see sendCommandAsync()
+static bool answerMatches(int eventno, const char *text, const char *okresponse)
+{
+    if (okresponse!=NULL && isdigit((unsigned char) okresponse[0])) return atoi(okresponse)==eventno;
+    if (eventno>=400) return false; // MOVI's errors
+    // "]" is what the synchronous sendCommand() takes any answer with
+    if (okresponse==NULL || okresponse[0]==0 || strcmp(okresponse, "]")==0) return true;
+    return strstr(text, okresponse)!=NULL;
+}
+
+bool MOVI::answerCommand(int eventno, const char *line)
+{
+    if (firstcommand==nextcommand || !answersCommand(eventno)) return false;
+    bool matched=answerMatches(eventno, line, commands[firstcommand%MOVI_COMMAND_QUEUE].okresponse);
+    finishCommand(matched ? COMMAND_OK : COMMAND_FAILED);
+    return true;
+}
+
+void MOVI::finishCommand(unsigned char status)
+{
+    commands[firstcommand%MOVI_COMMAND_QUEUE].status=status;
+    if (status!=COMMAND_OK) commandfailures++;
+    firstcommand++;
+}
+
+void MOVI::expireCommands()
+{
+    while (firstcommand!=nextcommand) {
+        PendingCommand *oldest=&commands[firstcommand%MOVI_COMMAND_QUEUE];
+        if (millis()-oldest->sent<oldest->timeout) return;
+        finishCommand(COMMAND_TIMEOUT);
+    }
+}
+
+void MOVI::sendLoopCommand(const char *command, const char *parameter)
+{
+    if (firstcommand!=nextcommand) { // its answer must not resolve a command of sendCommandAsync()
+        sendCommandAsync(command, parameter);
+        return;
+    }
+    mySerial->print(command);
+    if (parameter!=NULL) {
+        mySerial->print(" ");
+        mySerial->print(parameter);
+    }
+    mySerial->println("\n");
+}
+
 void MOVI::sendCommand(String command, String parameter)
 {
     if (firstsentence || intraining) sendCommand(command,parameter,"]"); // Use controlled sendcommand when used during initialization
-    else mySerial->println(command+" "+parameter+"\n");
+    else sendLoopCommand(command.c_str(), parameter.c_str());
 }
 
 void MOVI::sendCommand(String command)
 {
     if (firstsentence || intraining) sendCommand(command,"","]"); // Use controlled sendcommand when used during initialization
-    else mySerial->println(command+"\n");
+    else sendLoopCommand(command.c_str(), NULL);
 }
 
 void MOVI::sendCommand(const __FlashStringHelper* command, const __FlashStringHelper* parameter)
 {
     if (firstsentence || intraining) {  // Use controlled sendcommand when used during initialization
         sendCommand(command,parameter,"]");
+    } else if (firstcommand!=nextcommand) { // copied from flash only when it has to be queued
+        sendLoopCommand(String(command).c_str(), String(parameter).c_str());
     } else {
         mySerial->print(command);
         mySerial->print(" ");
@@ -314,6 +911,8 @@ void MOVI::sendCommand(const __FlashStringHelper* command)
 {
     if (firstsentence || intraining) { // Use controlled sendcommand when used during initialization
         sendCommand(command,F(""),"]");
+    } else if (firstcommand!=nextcommand) {
+        sendLoopCommand(String(command).c_str(), NULL);
     } else {
         mySerial->print(command);
         mySerial->println("\n");
@@ -322,14 +921,14 @@ void MOVI::sendCommand(const __FlashStringHelper* command)
 
 bool MOVI::isReady()
 {
-    if (shieldinit==100) {
-        return true;
-    }
     if (shieldinit==0) {
         init();
     }
+    if (shieldinit==100) {
+        return true;
+    }
     mySerial->println(F("PING\n"));
-    if (getShieldResponse().indexOf("PONG")) {
+    if (getShieldResponse().indexOf("PONG")>=0) {
         shieldinit=100;
         return true;
     }
@@ -340,6 +939,10 @@ bool MOVI::isReady()
 void MOVI::factoryDefault()
 {
     sendCommand(F("FACTORY"));
+    resync(); // all settings are back at their defaults
+#ifdef RASPBERRYPI
+    if (trainingcache) unlink(trainingcache); // MOVI forgot everything
+#endif
 }
 
 void MOVI::stopDialog()
@@ -394,6 +997,7 @@ void MOVI::abort()
 
 void MOVI::setSynthesizer(int synth)
 {
+    forgetSetting(SETTING_VOICE); // each synthesizer has its own voice
     if (synth==SYNTH_PICO) {
         sendCommand(F("SETSYNTH"),F("PICO"));
     } else {
@@ -403,6 +1007,7 @@ void MOVI::setSynthesizer(int synth)
 
 void MOVI::setSynthesizer(int synth, String commandline)
 {
+    forgetSetting(SETTING_VOICE);
     if (synth==SYNTH_PICO) {
             sendCommand("SETSYNTH","PICO "+commandline);
     } else {
@@ -451,45 +1056,300 @@ void MOVI::ask()
 
 void MOVI::callSign(String callsign)
 {
+#ifdef RASPBERRYPI
+    if (callsigntrainok) {
+        callsignname=callsign;
+        intern(callsign.c_str());
+    }
+#endif
     if (callsigntrainok) sendCommand("CALLSIGN",callsign,"callsign");
     callsigntrainok=false;
 }
 
+bool MOVI::hasSetting(unsigned char setting, int value)
+{
+    if (settingsknown & (1<<setting)) return settings[setting]==value;
+    if (settinghandles[setting]==0 || settings[setting]!=value) return false;
+    int status=commandStatus(settinghandles[setting]); // sent from loop(), see whether MOVI took it
+    if (status==COMMAND_PENDING) return true; // on its way, sending it again doesn't help
+    settinghandles[setting]=0;
+    if (status!=COMMAND_OK) return false;
+    settingsknown|=1<<setting;
+    return true;
+}
+
+void MOVI::noteSetting(unsigned char setting, int value, bool ok)
+{
+    settings[setting]=value;
+    settinghandles[setting]=0;
+    if (ok) settingsknown|=1<<setting;
+    else settingsknown&=~(1<<setting); // rejected or unanswered, so MOVI might have either value
+}
+
+void MOVI::forgetSetting(unsigned char setting)
+{
+    settingsknown&=~(1<<setting);
+    settinghandles[setting]=0;
+}
+
+void MOVI::sendSetting(unsigned char setting, int value, const char *command, const char *parameter)
+{
+    if (hasSetting(setting, value)) return; // MOVI has it already, spare the serial line
+    String number;
+    if (parameter==NULL) {
+        number=String(value);
+        parameter=number.c_str();
+    }
+    if (firstsentence || intraining) { // Use controlled sendcommand when used during initialization
+        bool ok=sendCommand(command, parameter, "]") && eventline && answerMatches(parseeventno, answerText(), NULL);
+        noteSetting(setting, value, ok);
+    } else {
+        // Not waited for in loop(), hasSetting() looks at the answer once poll() has matched it
+        noteSetting(setting, value, false);
+        settinghandles[setting]=sendCommandAsync(command, parameter);
+    }
+}
+
+void MOVI::resync()
+{
+    for (int i=0; i<SETTING_COUNT; i++) forgetSetting(i);
+}
+
 void MOVI::responses(bool on)
 {
-    String parameter="ON";
-    if (!on) parameter="OFF";
-    sendCommand("RESPONSES",parameter);
+    sendSetting(SETTING_RESPONSES, on, "RESPONSES", on ? "ON" : "OFF");
 }
 
 void MOVI::welcomeMessage(bool on)
 {
-    String parameter="ON";
-    if (!on) parameter="OFF";
-    sendCommand("WELCOMEMESSAGE",parameter);
+    sendSetting(SETTING_WELCOME, on, "WELCOMEMESSAGE", on ? "ON" : "OFF");
 }
 
 void MOVI::beeps(bool on)
 {
-    String parameter="ON";
-    if (!on) parameter="OFF";
-    sendCommand("BEEPS",parameter);
+    sendSetting(SETTING_BEEPS, on, "BEEPS", on ? "ON" : "OFF");
 }
 
 void MOVI::setVoiceGender(bool female)
 {
-    if (female) sendCommand(F("FEMALE"));
-    else sendCommand(F("MALE"));
+    if (female) sendSetting(SETTING_VOICE, female, "FEMALE", "");
+    else sendSetting(SETTING_VOICE, female, "MALE", "");
 }
 
 void MOVI::setVolume(int volume)
 {
-    sendCommand("VOLUME",String(volume));
+    sendSetting(SETTING_VOLUME, volume, "VOLUME", NULL);
 }
 
 void MOVI::setThreshold(int threshold)
 {
-    sendCommand("THRESHOLD",String(threshold));
+    sendSetting(SETTING_THRESHOLD, threshold, "THRESHOLD", NULL);
+}
+
+MOVI::Config::Config()
+{
+    set=0;
+}
+
+MOVI::Config &MOVI::Config::volume(int volume)
+{
+    volumevalue=volume;
+    set|=CONFIG_VOLUME;
+    return *this;
+}
+
+MOVI::Config &MOVI::Config::threshold(int threshold)
+{
+    thresholdvalue=threshold;
+    set|=CONFIG_THRESHOLD;
+    return *this;
+}
+
+MOVI::Config &MOVI::Config::synthesizer(int synth)
+{
+    synthvalue=synth;
+    set|=CONFIG_SYNTHESIZER;
+    return *this;
+}
+
+MOVI::Config &MOVI::Config::voiceGender(bool female)
+{
+    femalevalue=female;
+    set|=CONFIG_VOICE;
+    return *this;
+}
+
+MOVI::Config &MOVI::Config::beeps(bool on)
+{
+    beepsvalue=on;
+    set|=CONFIG_BEEPS;
+    return *this;
+}
+
+MOVI::Config &MOVI::Config::responses(bool on)
+{
+    responsesvalue=on;
+    set|=CONFIG_RESPONSES;
+    return *this;
+}
+
+MOVI::Config &MOVI::Config::welcomeMessage(bool on)
+{
+    welcomevalue=on;
+    set|=CONFIG_WELCOME;
+    return *this;
+}
+
+MOVI::Config &MOVI::Config::callSign(String callsign)
+{
+    callsignvalue=callsign;
+    set|=CONFIG_CALLSIGN;
+    return *this;
+}
+
+// A command apply() has sent and waits for the answer of
+struct ConfigCommand {
+    unsigned char bit;               // CONFIG_* of the setting
+    signed char setting;             // SETTING_* of its shadow, -1 if it has none
+    int value;                       // sent if parameter is NULL
+    const char *command;
+    const char *parameter;
+    const char *okresponse;
+};
+
+unsigned char MOVI::apply(const Config &config, unsigned long timeout)
+{
+    ConfigCommand sent[8];
+    int count=0;
+    unsigned char failed=0;
+    
+    collectAcks(0); // the answers must not be sentence acknowledgments
+    drainCommands(); // nor answers to an earlier sendCommandAsync()
+    if (!isReady()) return config.set;
+    // In the order of the CONFIG_* bits, so the voice gender comes after the synthesizer that resets it
+    for (unsigned char bit=CONFIG_VOLUME; bit!=0; bit<<=1) {
+        if (!(config.set & bit)) continue;
+        const char *command;
+        const char *parameter=NULL;
+        const char *okresponse="]";
+        signed char setting=-1;
+        int value=0;
+        switch (bit) {
+            case CONFIG_VOLUME:
+                command="VOLUME";
+                value=config.volumevalue;
+                setting=SETTING_VOLUME;
+                break;
+            case CONFIG_THRESHOLD:
+                command="THRESHOLD";
+                value=config.thresholdvalue;
+                setting=SETTING_THRESHOLD;
+                break;
+            case CONFIG_SYNTHESIZER:
+                command="SETSYNTH";
+                parameter=config.synthvalue==SYNTH_PICO ? "PICO" : "ESPEAK";
+                forgetSetting(SETTING_VOICE);
+                break;
+            case CONFIG_VOICE:
+                command=config.femalevalue ? "FEMALE" : "MALE";
+                parameter="";
+                value=config.femalevalue;
+                setting=SETTING_VOICE;
+                break;
+            case CONFIG_BEEPS:
+                command="BEEPS";
+                value=config.beepsvalue;
+                parameter=value ? "ON" : "OFF";
+                setting=SETTING_BEEPS;
+                break;
+            case CONFIG_RESPONSES:
+                command="RESPONSES";
+                value=config.responsesvalue;
+                parameter=value ? "ON" : "OFF";
+                setting=SETTING_RESPONSES;
+                break;
+            case CONFIG_WELCOME:
+                command="WELCOMEMESSAGE";
+                value=config.welcomevalue;
+                parameter=value ? "ON" : "OFF";
+                setting=SETTING_WELCOME;
+                break;
+            default: // CONFIG_CALLSIGN
+                if (!callsigntrainok) continue; // like callSign(), only the first one counts
+                callsigntrainok=false;
+#ifdef RASPBERRYPI
+                callsignname=config.callsignvalue;
+                intern(config.callsignvalue.c_str());
+#endif
+                command="CALLSIGN";
+                parameter=config.callsignvalue.c_str();
+                okresponse="callsign";
+                break;
+        }
+        if (setting>=0 && hasSetting(setting, value)) continue;
+        ConfigCommand *c=&sent[count++];
+        c->bit=bit;
+        c->setting=setting;
+        c->value=value;
+        c->command=command;
+        c->parameter=parameter;
+        c->okresponse=okresponse;
+    }
+    
+    // SoftwareSerial can't receive while it sends, so with a window of 1 (its default) every command waits for
+    // its answer. Otherwise they all go out back to back, on the Raspberry Pi in one write.
+    bool stream=ackwindow>1;
+#ifdef RASPBERRYPI
+    HardwareSerial *port=(HardwareSerial *)mySerial;
+    uint8_t policy=port->getFlushPolicy();
+    if (stream) port->setFlushPolicy(SERIAL_FLUSH_EXPLICIT);
+#endif
+    int answered=0;
+    unsigned long start=millis();
+    unsigned long waited=0;
+    for (int i=0; i<count; i++) {
+        mySerial->print(sent[i].command);
+        mySerial->print(" ");
+        if (sent[i].parameter) mySerial->print(sent[i].parameter);
+        else mySerial->print(sent[i].value);
+        mySerial->println("\n");
+        if (stream && i+1<count) continue;
+        mySerial->flush();
+#ifdef RASPBERRYPI
+        if (readerrunning) continue; // answers only show up as events now
+#endif
+        while (answered<=i && waited<timeout && readLine(timeout-waited)) {
+            waited=millis()-start;
+            if (!eventline || !answersCommand(parseeventno)) continue; // MOVI answers in order, its own events don't count
+            ConfigCommand *c=&sent[answered++];
+            bool ok=answerMatches(parseeventno, answerText(), c->okresponse);
+            if (c->setting>=0) noteSetting(c->setting, c->value, ok);
+            if (!ok) failed|=c->bit;
+        }
+        if (answered<=i) break; // no answer in time
+    }
+#ifdef RASPBERRYPI
+    port->setFlushPolicy(policy);
+    if (readerrunning) { // nothing is known about the answers, so nothing is remembered
+        for (int i=0; i<count; i++) {
+            if (sent[i].setting>=0) noteSetting(sent[i].setting, sent[i].value, false);
+        }
+        return 0;
+    }
+#endif
+    if (answered<count) {
+        // Some command got no answer. Streamed, which one can't be told from the answers, so none counts. One
+        // by one, the answered ones are known and the rest wasn't answered or sent.
+        for (int i=stream ? 0 : answered; i<count; i++) {
+            if (sent[i].setting>=0) noteSetting(sent[i].setting, sent[i].value, false);
+            failed|=sent[i].bit;
+        }
+    }
+    if (debug && failed) {
+        Serial.print(F("MOVI::apply() failed for settings 0x"));
+        Serial.println(failed, HEX);
+    }
+    return failed;
 }
 
 float MOVI::getFirmwareVersion()
@@ -502,44 +1362,362 @@ float MOVI::getAPIVersion()
     return API_VERSION;
 }
 
+unsigned long MOVI::getBootTime()
+{
+    return boottime;
+}
+
 float MOVI::getHardwareVersion()
 {
     return hardwareversion;
 }
 
-bool MOVI::addSentence(const __FlashStringHelper* sentence)
+bool MOVI::readLine(unsigned long timeout)
+{
+    unsigned long start=millis();
+    unsigned long waited=0;
+#ifdef RASPBERRYPI
+    if (readerrunning) return false;
+#endif
+    for (;;) {
+        while (mySerial->available()) {
+            if (!parseChar((char) mySerial->read())) continue;
+            for (unsigned int i=0; i<linelen; i++) {
+                if (!isspace((unsigned char) linebuf[i])) return true;
+            }
+        }
+        if (waited>=timeout) return false;
+        waitSerial(timeout-waited);
+        waited=millis()-start;
+    }
+}
+
+void MOVI::collectAcks(int maxoutstanding)
+{
+    while (outstanding>maxoutstanding) {
+        if (!readLine(MOVI_ACK_TIMEOUT)) { // MOVI stopped answering, count all outstanding sentences as failed
+            while (outstanding>0) {
+                if (failedlist) failedlist[sentencesacked-failedbase]=true;
+                sentencefailures++;
+                sentencesacked++;
+                outstanding--;
+            }
+            intraining=false;
+            return;
+        }
+        if (strstr(linebuf,"211")==NULL) {
+            if (failedlist) failedlist[sentencesacked-failedbase]=true;
+            sentencefailures++;
+            intraining=false;
+        }
+        sentencesacked++;
+        outstanding--;
+    }
+}
+
+bool MOVI::beginSentence()
 {
+    // Needs a new MOVI instance (typically restart Arduino). This avoids training only part of the sentence set.
     if (firstsentence) {
         intraining=sendCommand(F("NEWSENTENCES"),F(""),"210");
         firstsentence=false;
     }
     if (!intraining) return false;
-    intraining=sendCommand(F("ADDSENTENCE"),sentence,"211");
+    drainCommands(); // answers to sendCommandAsync() must not count as acknowledgments
+    collectAcks(ackwindow-1);
+    return true;
+}
+
+void MOVI::setAckWindow(int window)
+{
+    if (window<1) window=1;
+    ackwindow=window;
+}
+
+void MOVI::sendSentence(const char *sentence)
+{
+#ifdef RASPBERRYPI
+    if (!trainingcache) addSentenceId(sentence); // with the cache queueSentence() already did
+#endif
+    mySerial->print(F("ADDSENTENCE "));
+    mySerial->print(sentence);
+    mySerial->println(F("\n"));
+    outstanding++;
+}
+
+bool MOVI::addSentence(const __FlashStringHelper* sentence)
+{
+#ifdef RASPBERRYPI
+    if (trainingcache) return queueSentence(sentence);
+#endif
+    if (!beginSentence()) return false;
+#ifdef RASPBERRYPI
+    addSentenceId(sentence);
+#endif
+    mySerial->print(F("ADDSENTENCE "));
+    mySerial->print(sentence);
+    mySerial->println(F("\n"));
+    outstanding++;
+    if (ackwindow==1) collectAcks(0);
     return intraining;
 }
 
 bool MOVI::addSentence(String sentence)
 {
-    // Needs a new MOVI instance (typically restart Arduino). This avoids training only part of the sentence set.
-    if (firstsentence) {
-        intraining=sendCommand("NEWSENTENCES","","210");
+#ifdef RASPBERRYPI
+    if (trainingcache) return queueSentence(sentence.c_str());
+#endif
+    if (!beginSentence()) return false;
+    sendSentence(sentence.c_str());
+    if (ackwindow==1) collectAcks(0);
+    return intraining;
+}
+
+int MOVI::addSentences(const char * const sentences[], int count, bool *failed)
+{
+    int i;
+    if (failed) {
+        for (i=0; i<count; i++) failed[i]=false;
+    }
+#ifdef RASPBERRYPI
+    if (trainingcache) {
+        int rejected=0;
+        for (i=0; i<count; i++) {
+            if (!queueSentence(sentences[i])) {
+                if (failed) failed[i]=true;
+                rejected++;
+            }
+        }
+        return rejected;
+    }
+#endif
+    if (!beginSentence()) {
+        if (failed) {
+            for (i=0; i<count; i++) failed[i]=true;
+        }
+        return count;
+    }
+    collectAcks(0); // acknowledgments of earlier addSentence() calls don't belong to this batch
+    bool ok=intraining;
+    int before=sentencefailures;
+    failedlist=failed;
+    failedbase=sentencesacked;
+    for (i=0; i<count; i++) {
+        collectAcks(ackwindow-1);
+        sendSentence(sentences[i]);
+    }
+    collectAcks(0);
+    failedlist=NULL;
+    int rejected=sentencefailures-before;
+    intraining=ok && rejected==0;
+    return rejected;
+}
+
+#ifdef RASPBERRYPI
+bool MOVI::queueSentence(const char *sentence)
+{
+    if (firstsentence) { // same rules as without the cache: only in setup() and before train()
+        intraining=true;
         firstsentence=false;
     }
     if (!intraining) return false;
-    intraining=sendCommand("ADDSENTENCE",sentence,"211");
+    addSentenceId(sentence);
+    pendingsentences+=sentence;
+    pendingsentences+='\n';
+    return true;
+}
+
+bool MOVI::uploadSentences()
+{
+    if (!sendCommand(F("NEWSENTENCES"),F(""),"210")) return false;
+    intraining=true;
+    unsigned int start=0;
+    int end;
+    while ((end=pendingsentences.indexOf('\n',start))>=0) {
+        pendingsentences.setCharAt(end,0);
+        collectAcks(ackwindow-1);
+        sendSentence(pendingsentences.c_str()+start);
+        pendingsentences.setCharAt(end,'\n');
+        start=end+1;
+    }
+    collectAcks(0);
     return intraining;
 }
 
+// 64 bit FNV-1a, case insensitive like MOVI
+static void fingerprintAdd(uint64_t *hash, const char *s)
+{
+    while (*s) {
+        *hash^=(unsigned char) toupper((unsigned char) *s++);
+        *hash*=1099511628211ULL;
+    }
+}
+
+bool MOVI::train()
+{
+    collectAcks(0);
+    if (!intraining) return false;
+    intraining=false;
+    if (trainingcache==NULL) {
+        sendCommand("TRAINSENTENCES","","trained",MOVI_TRAIN_TIMEOUT);
+        return true;
+    }
+    
+    char fingerprint[64];
+    char stored[64];
+    uint64_t hash=14695981039346656037ULL;
+    fingerprintAdd(&hash, callsignname.c_str());
+    fingerprintAdd(&hash, "\n");
+    fingerprintAdd(&hash, pendingsentences.c_str());
+    snprintf(fingerprint, sizeof(fingerprint), "%016llx %.2f %.2f\n", (unsigned long long) hash,
+             firmwareversion, hardwareversion);
+    
+    FILE *fp=fopen(trainingcache, "r");
+    if (fp) {
+        bool same=fgets(stored, sizeof(stored), fp) && strcmp(stored, fingerprint)==0;
+        fclose(fp);
+        if (same) {
+            if (debug) Serial.println(F("Sentences unchanged since last training, not sending them."));
+            pendingsentences="";
+            return true;
+        }
+    }
+    
+    bool ok=uploadSentences();
+    intraining=false;
+    pendingsentences="";
+    if (!ok) return false;
+    if (!sendCommand("TRAINSENTENCES","","trained",MOVI_TRAIN_TIMEOUT)) return true; // old behavior, but don't remember
+    
+    static bool reported=false;
+    for (int slash=trainingcachepath.indexOf('/', 1); slash>0; slash=trainingcachepath.indexOf('/', slash+1)) {
+        mkdir(trainingcachepath.substring(0,slash).c_str(), 0700);
+    }
+    fp=fopen(trainingcache, "w");
+    if (fp) {
+        fputs(fingerprint, fp);
+        fclose(fp);
+    } else if (!reported) { // once, a sketch started over and over shouldn't fill the log
+        reported=true;
+        fprintf(stderr, "Pi: Can't store the training fingerprint in %s: %s. Sentences will be sent on every start.\n",
+                trainingcache, strerror(errno));
+    }
+    return true;
+}
+#else
 bool MOVI::train()
 {
+    collectAcks(0);
     if (!intraining) return false;
-    sendCommand("TRAINSENTENCES","","trained");
+    sendCommand("TRAINSENTENCES","","trained",MOVI_TRAIN_TIMEOUT);
     intraining=false;
     return true;
 }
 
+#endif
+
+#ifdef RASPBERRYPI
+
+void MOVI::answerQueued()
+{
+    unsigned int tail=__atomic_load_n(&queuetail, __ATOMIC_ACQUIRE);
+    for (unsigned int i=queuehead; i!=tail && firstcommand!=nextcommand; i++) {
+        EventRecord *record=&eventqueue[i%MOVI_EVENT_QUEUE];
+        // records between head and tail belong to the consumer, readEvent() skips the answered ones
+        if (record->event<0 && answerCommand(-record->event, record->result)) record->event=SHIELD_IDLE;
+    }
+}
+
+void MOVI::pushEvent(unsigned long time)
+{
+    unsigned int tail=queuetail;
+    
+    if (!eventline) {
+        if (linecontent) countLine(&droppedlines); // not MOVI's
+        return;
+    }
+    if (tail-__atomic_load_n(&queuehead, __ATOMIC_ACQUIRE)>=MOVI_EVENT_QUEUE) { // loop() is too slow, drop it
+        countLine(&droppedlines);
+        return;
+    }
+    EventRecord *record=&eventqueue[tail%MOVI_EVENT_QUEUE];
+    record->event=decodeEvent(record->result);
+    if (record->event==SHIELD_IDLE) return;
+    record->time=time;
+    __atomic_store_n(&queuetail, tail+1, __ATOMIC_RELEASE);
+}
+
+// Reads the serial port's descriptor directly, HardwareSerial's buffers are left to loop().
+void *MOVI::readerMain(void *movi)
+{
+    MOVI *self=(MOVI *) movi;
+    struct pollfd pfd;
+    char buf[SERIAL_RX_BUFFER_SIZE];
+    
+    pfd.fd=((HardwareSerial *) self->mySerial)->getFd();
+    pfd.events=POLLIN;
+    while (__atomic_load_n(&self->readerrunning, __ATOMIC_ACQUIRE)) {
+        if (::poll(&pfd, 1, 100)<=0) continue; // wake up regularly to notice stopReader()
+        ssize_t n=read(pfd.fd, buf, sizeof(buf));
+        if (n<=0) {
+            delay(10);
+            continue;
+        }
+        unsigned long time=micros();
+        for (ssize_t i=0; i<n; i++) {
+            if (self->parseChar(buf[i])) self->pushEvent(time);
+        }
+    }
+    return NULL;
+}
+
+bool MOVI::startReader()
+{
+    if (readerrunning) return true;
+    if (reactorActive()) { // the reactor would read the port from the main thread
+        fprintf(stderr, "Pi: MOVI reader thread can't be used in reactor mode\n");
+        return false;
+    }
+    if (shieldinit==0) init();
+    if (outstanding>0) collectAcks(0);
+    firstsentence=false; // from now on nothing waits for a response
+    intraining=false;
+    while (mySerial->available()) { // what HardwareSerial already buffered, the thread only sees new input
+        if (parseChar((char) mySerial->read())) pushEvent(micros());
+    }
+    readerrunning=true;
+    if (pthread_create(&readerthread, NULL, readerMain, this)!=0) {
+        fprintf(stderr, "Pi: Can't start MOVI reader thread\n");
+        readerrunning=false;
+        return false;
+    }
+    ((HardwareSerial *)mySerial)->setReaderThread(true); // on the Pi it always is one
+    return true;
+}
+
+void MOVI::stopReader()
+{
+    if (!readerrunning) return;
+    __atomic_store_n(&readerrunning, false, __ATOMIC_RELEASE);
+    pthread_join(readerthread, NULL);
+    ((HardwareSerial *)mySerial)->setReaderThread(false);
+}
+
+#endif
+
 MOVI::~MOVI()
 {
+#ifdef RASPBERRYPI
+    stopReader();
+#endif
+    free(sentencehandlers);
+    free(eventhandlers);
+#ifdef RASPBERRYPI
+    for (unsigned int i=0; i<phrasecount; i++) free(phrases[i]);
+    free(phrases);
+    free(phraseindex);
+    free(sentenceids);
+#endif
     if (NULL != mySerial && (!usehardwareserial))
     {
         delete mySerial;
@@ -32,6 +32,10 @@
 
 #include "Arduino.h"
 
+#ifdef RASPBERRYPI
+#include <pthread.h>
+#endif
+
 #ifndef API_VERSION
 #define API_VERSION 1.20f
 #endif
@@ -49,6 +53,54 @@
 #endif                         // As of firmware 1.10 changing the bitrate is possible with a config file on the SDcard but
                                // then HardwareSerial must be used and initialized before constructing MOVI
 
+#ifndef MOVI_LINE_MAX
+#define MOVI_LINE_MAX 128  // Longest line from MOVI that is kept. Longer lines are still parsed but their result is cut.
+#endif
+
+#ifndef MOVI_ACK_WINDOW
+#define MOVI_ACK_WINDOW 4  // Default number of sentences sent to MOVI before waiting for an acknowledgment
+#endif
+
+#ifndef MOVI_ACK_TIMEOUT
+#define MOVI_ACK_TIMEOUT 5000  // Milliseconds to wait for MOVI to acknowledge a sentence
+#endif
+
+#ifndef MOVI_RESPONSE_TIMEOUT
+#define MOVI_RESPONSE_TIMEOUT 2000  // Milliseconds to wait for MOVI to answer a command in setup()
+#endif
+
+#ifndef MOVI_TRAIN_TIMEOUT
+#define MOVI_TRAIN_TIMEOUT 120000  // Milliseconds to wait for MOVI to finish training
+#endif
+
+#ifndef MOVI_BOOT_PROBE
+#define MOVI_BOOT_PROBE 50  // Milliseconds init() first waits for MOVI to answer, doubled after every unanswered probe
+#endif
+
+#ifndef MOVI_BOOT_PROBE_MAX
+#define MOVI_BOOT_PROBE_MAX 1000  // Longest wait between two probes while MOVI boots
+#endif
+
+#ifndef MOVI_BOOT_TIMEOUT
+#define MOVI_BOOT_TIMEOUT 60000  // Milliseconds init() waits for MOVI to boot before it gives up, isReady() tries again later
+#endif
+
+#ifndef MOVI_COMMAND_QUEUE
+#define MOVI_COMMAND_QUEUE 4  // Commands sent by sendCommandAsync() that may wait for MOVI's answer at the same time
+#endif
+
+#ifndef MOVI_COMMAND_WAIT
+#define MOVI_COMMAND_WAIT 2000  // Default milliseconds sendCommandAsync() gives MOVI to answer
+#endif
+
+#ifndef MOVI_EVENT_QUEUE
+#define MOVI_EVENT_QUEUE 16  // Raspberry Pi only: events the reader thread can hold until poll() picks them up
+#endif
+
+#ifndef MOVI_TRAINING_CACHE
+#define MOVI_TRAINING_CACHE "movi/training"  // Raspberry Pi only: remembers the last trained sentence set, relative to $XDG_CACHE_HOME
+#endif
+
 // --- MOVI events ---
 
 #ifndef SHIELD_IDLE
@@ -99,6 +151,62 @@
 #define UNKNOWN_SENTENCE -502
 #endif
 
+// --- MOVI::Config settings, see apply() ---
+
+#ifndef CONFIG_VOLUME
+#define CONFIG_VOLUME 0x01
+#endif
+
+#ifndef CONFIG_THRESHOLD
+#define CONFIG_THRESHOLD 0x02
+#endif
+
+#ifndef CONFIG_SYNTHESIZER
+#define CONFIG_SYNTHESIZER 0x04
+#endif
+
+#ifndef CONFIG_VOICE
+#define CONFIG_VOICE 0x08
+#endif
+
+#ifndef CONFIG_BEEPS
+#define CONFIG_BEEPS 0x10
+#endif
+
+#ifndef CONFIG_RESPONSES
+#define CONFIG_RESPONSES 0x20
+#endif
+
+#ifndef CONFIG_WELCOME
+#define CONFIG_WELCOME 0x40
+#endif
+
+#ifndef CONFIG_CALLSIGN
+#define CONFIG_CALLSIGN 0x80
+#endif
+
+// --- sendCommandAsync() states, see commandStatus() ---
+
+#ifndef COMMAND_PENDING
+#define COMMAND_PENDING 0
+#endif
+
+#ifndef COMMAND_OK
+#define COMMAND_OK 1
+#endif
+
+#ifndef COMMAND_FAILED
+#define COMMAND_FAILED 2  // MOVI answered something else
+#endif
+
+#ifndef COMMAND_TIMEOUT
+#define COMMAND_TIMEOUT 3
+#endif
+
+#ifndef COMMAND_UNKNOWN
+#define COMMAND_UNKNOWN 4  // invalid handle or too old to be remembered
+#endif
+
 // --- MOVI useful constants ---
 
 #ifndef MALE_VOICE
@@ -117,6 +225,9 @@
 #define SYNTH_PICO 1  //  Constant for setSynthesizer method
 #endif
 
+// Handler for dispatch(). Gets poll()'s value and the result, which is only valid during the call.
+typedef void (*MOVIHandler)(signed int event, const char *result, unsigned int length);
+
 class MOVI
 {
     
@@ -138,7 +249,7 @@ public:
     MOVI(bool debugonoff, HardwareSerial *hs);
     
     // init waits for MOVI to be booted and resets some settings. If the recognizer had been stopped with
-    // stopDialog() it is restarted.
+    // stopDialog() it is restarted. It gives up after MOVI_BOOT_TIMEOUT, isReady() then tells when MOVI is there.
     void init();
     
     // This init method only initializes the API and doesn't wait for MOVI to be ready if the parameter is false.
@@ -147,6 +258,10 @@ public:
     // This method can be used to determine if MOVI is ready to receive commands, e.g. when MOVI has been initialized with init(false).
     bool isReady();
     
+    // Returns true if MOVI didn't answer the last command that was waited for within MOVI_RESPONSE_TIMEOUT
+    // milliseconds (MOVI_TRAIN_TIMEOUT for train()), so a failed command can be told from a dead or busy board.
+    bool timedOut();
+    
     // This method adds a sentence to the training set. Sentences must not contain any punctuation or numbers.
     // Everything must be spelled out. No special characters, umlauts or accents. Uppercase or lowercase does
     // not matter.
@@ -155,9 +270,27 @@ public:
     // addsentence using Flash memory (e.g., addsentence(F("Light On");)
     bool addSentence(const __FlashStringHelper* sentence);
     
+    // Adds count sentences to the training set. Sentences are streamed to MOVI without waiting for each
+    // acknowledgment (see setAckWindow()). All sentences are sent even if MOVI rejects some of them, but then
+    // train() will refuse to train. Returns the number of rejected sentences. If failed is not NULL, failed[i]
+    // is set to true for every rejected sentence i.
+    int addSentences(const char * const sentences[], int count, bool *failed=NULL);
+    
+    // Sets how many sentences addSentence() and addSentences() may send before MOVI has acknowledged them.
+    // Default is MOVI_ACK_WINDOW, or 1 with SoftwareSerial, which garbles what arrives while it sends. A window of
+    // 1 waits for every acknowledgment. It is also used by apply(). Because of the window,
+    // addSentence() only reports rejections of earlier sentences, train() reports all of them.
+    void setAckWindow(int window);
+    
     // This method checks if the training set contains new sentences since the last training. If so, it trains all
     // sentences added in this MOVI instance. Once training is performed, no more sentences can be added
     // and training cannot be invoked again in the same instance.
+    // On the Raspberry Pi, addSentence() and addSentences() only collect the sentences. train() compares a
+    // fingerprint of the callsign, the sentences in order and MOVI's version with the one stored in
+    // MOVI_TRAINING_CACHE (or $MOVI_TRAINING_CACHE, empty to disable; a relative name is taken from $XDG_CACHE_HOME
+    // or ~/.cache) after the last successful training and
+    // skips the upload if they match. In that case addSentences() cannot report rejected sentences, train()
+    // returns false instead. factoryDefault() deletes the stored fingerprint.
     bool train();
     
     // This method sets the callsign to the parameter given. If the callsign has previously been set to the
@@ -186,6 +319,46 @@ public:
     // Turns the recognition beeps on or off.
     void beeps(bool on);
     
+    // The methods above only send a setting to MOVI when it differs from the last one MOVI accepted. In loop() they
+    // don't wait for the answer, the setting counts once poll() has matched it (see sendCommandAsync()) and isn't
+    // sent again while it is on its way. Call resync() when MOVI may have changed settings behind their back, e.g.
+    // after it rebooted or after sendCommand() changed one, so that the next call of each is sent again.
+    void resync();
+    
+    // Collects settings for apply(), e.g.
+    // recognizer.apply(MOVI::Config().volume(80).beeps(false).callSign("Arduino"));
+    class Config {
+    public:
+        Config();
+        Config &volume(int volume);
+        Config &threshold(int threshold);
+        Config &synthesizer(int synth);
+        Config &voiceGender(bool female);
+        Config &beeps(bool on);
+        Config &responses(bool on);
+        Config &welcomeMessage(bool on);
+        Config &callSign(String callsign);
+    private:
+        friend class MOVI;
+        unsigned char set;           // CONFIG_* bits of the settings above that were called
+        int volumevalue;
+        int thresholdvalue;
+        int synthvalue;
+        bool femalevalue;
+        bool beepsvalue;
+        bool responsesvalue;
+        bool welcomevalue;
+        String callsignvalue;
+    };
+    
+    // Sends the settings of config that MOVI doesn't have yet in one go and then waits at most timeout
+    // milliseconds for all of MOVI's answers, instead of one round trip per setting. With an acknowledgment window
+    // of 1 (see setAckWindow()) each setting waits for its answer instead. Returns the CONFIG_* bits of
+    // the settings MOVI rejected, 0 if all went through. If answers are missing when the time is up, all settings
+    // that were sent count as failed, as the answers can't tell which one MOVI skipped. Only works in setup(),
+    // before poll().
+    unsigned char apply(const Config &config, unsigned long timeout=MOVI_RESPONSE_TIMEOUT);
+    
     // --- Methods that are typically used in loop() ---
     
     // This method is called in loop() to get an event from the recognizer. 0 stand for no event. A postive number
@@ -198,6 +371,67 @@ public:
     // is uppercase and does not contain any numbers, punctuation or special characters.
     String getResult();
     
+#ifdef RASPBERRYPI
+    // Same as getResult() but without copying: the view points into MOVI's result buffer and is valid until the
+    // next call of poll().
+    StringView getResultView();
+#endif
+    
+#ifdef RASPBERRYPI
+    // Returns a stable id (starting at 1) for a phrase, adding it to a table of known phrases if needed, so
+    // results can be compared as integers with getResultId(). Sentences given to addSentence() and the callsign
+    // are added automatically. Like in MOVI's results, case and extra whitespace don't matter. Password checks
+    // don't use the table, they compare the answer with the passkey exactly as on the Arduino.
+    // Returns 0 if there is not enough memory.
+    int intern(const char *phrase);
+    
+    // Returns the id of the last result, 0 if it isn't a known phrase (see intern()). For a recognized sentence
+    // that is the id of the sentence as given to addSentence().
+    int getResultId();
+    
+    // Returns the phrase of an id as stored in the table (uppercase). It stays valid as long as the MOVI object.
+    // NULL if the id is unknown.
+    const char *getPhrase(int id);
+#endif
+    
+    // Return how many lines poll() threw away because they weren't MOVI events (noise, a wrong baud rate, MOVI
+    // booting, garbled numbers) or, with the reader thread, because the event queue was full. Answers read by
+    // commands and input init() discards on purpose don't count. Also returns how many lines were longer than
+    // MOVI_LINE_MAX and got cut. However much arrives, MOVI only ever keeps MOVI_LINE_MAX characters of a line.
+    unsigned long getDroppedLines();
+    unsigned long getOversizedLines();
+    
+    // Returns the time in microseconds (see micros()) at which the line of the last event returned by poll()
+    // arrived from MOVI.
+    unsigned long getEventTime();
+    
+    // Registers a handler that dispatch() calls when the given sentence (starting at 1) is recognized. NULL
+    // removes it. Returns false if there is not enough memory.
+    bool onSentence(int sentence, MOVIHandler handler);
+    
+    // Registers a handler that dispatch() calls for the given event, e.g. BEGIN_SAY, RAW_WORDS or PASSWORD_ACCEPT.
+    // NULL removes it. Returns false if there is not enough memory or the event doesn't exist.
+    bool onEvent(signed int event, MOVIHandler handler);
+    
+    // Registers a handler for sentences and events that have no handler of their own.
+    void onOther(MOVIHandler handler);
+    
+    // Calls poll() and hands the event to its handler. Returns what poll() returned, so loop() can still react
+    // to events itself.
+    signed int dispatch();
+    
+#ifdef RASPBERRYPI
+    // Starts a thread that reads and parses MOVI's output as it arrives, so events don't wait for loop() to call
+    // poll() and their time is taken on arrival. poll() then only picks up the next event from a queue of
+    // MOVI_EVENT_QUEUE events. Call it at the end of setup(): afterwards no more sentences can be trained, no
+    // command waits for MOVI's response and nothing else may read Serial1. Fails in reactor mode, and reactorMode()
+    // fails while the reader runs.
+    bool startReader();
+    
+    // Stops the reader thread. Events still in the queue are returned by poll() before new ones are read.
+    void stopReader();
+#endif
+    
     // Makes MOVI speak the sentence given as parameter using the speech synthesizer.
     void say(String sentence);
     
@@ -263,12 +497,36 @@ public:
     // Sends a command manually to MOVI. Flash memory version for AVR
     void sendCommand(const __FlashStringHelper* command, const __FlashStringHelper* parameter);
     
+    // Sends a command to MOVI without waiting for its answer and returns a handle for commandStatus(). If okresponse
+    // is a number, the command succeeds if MOVI answers with that event number. Otherwise the answer must not be
+    // one of MOVI's 4xx errors and its text after "MOVIEvent[NNN]: " must contain okresponse (NULL, "" or "]" take
+    // any text). okresponse must stay valid until then, e.g. a string literal. poll() and waitCommands() match
+    // MOVI's answers to the outstanding commands in order, so a command MOVI doesn't answer at all takes the next
+    // answer until its time is up. While commands are outstanding, commands sent by the other methods take their
+    // place in the queue as well. MOVI's own events (listening, speaking, recognition) still go to poll()'s caller.
+    // Only waits if MOVI_COMMAND_QUEUE commands are outstanding already. On the Raspberry Pi events arriving
+    // meanwhile are kept for poll() (up to MOVI_EVENT_QUEUE), elsewhere they are lost. Returns 0 if MOVI isn't
+    // ready.
+    unsigned int sendCommandAsync(const char *command, const char *parameter=NULL, const char *okresponse=NULL,
+                                  unsigned long timeout=MOVI_COMMAND_WAIT);
+    
+    // Returns COMMAND_PENDING until MOVI has answered the command of the handle or its time is up, then
+    // COMMAND_OK, COMMAND_FAILED or COMMAND_TIMEOUT. Only the last MOVI_COMMAND_QUEUE commands are remembered.
+    int commandStatus(unsigned int handle);
+    
+    // Waits until MOVI has answered all outstanding commands or their time is up. Events arriving meanwhile are
+    // kept for poll() like in sendCommandAsync(). Returns how many commands failed or timed out since the last call.
+    int waitCommands();
+    
     // Returns MOVI's firmware version.
     float getFirmwareVersion();
     
     // Returns MOVI's board revision.
     float getHardwareVersion();
     
+    // Returns how many milliseconds init() waited for MOVI to boot and answer, 0 if init(false) didn't get an answer.
+    unsigned long getBootTime();
+    
     // Returns the version of this API.
     float getAPIVersion();
     
@@ -291,6 +549,11 @@ private:
     float hardwareversion; // stores hardware version
     float firmwareversion; // stores firmware version
     int shieldinit;        // stores the init state of the MOVI object
+    unsigned long boottime; // see getBootTime()
+    void drainInput();     // throws away what MOVI sent before, including a partial line
+    bool probeBoot(unsigned long timeout); // sends INIT and reads the versions from MOVI's answer, false on timeout
+    bool skipBanner(unsigned long timeout); // reads until linebuf holds the answer to INIT, false on timeout
+    bool syncAnswers(unsigned long timeout); // sends PING and reads until its answer, false on timeout
     bool callsigntrainok;  // makes sure callsign is only called once
     bool debug;            // debug allows serial monitor interfacing
     bool intraining;       // determines if training is ok
@@ -301,14 +564,122 @@ private:
 
     Stream *mySerial;
     
-    String response; // stores the stream of serial communication characters
-    String result;   // stores the last result for getResult()
-    String getShieldResponse(); // used to communicate with the shield before poll()
+    // Shadow of the settings MOVI has, so that setting the same value again doesn't cost a command.
+    enum { SETTING_VOLUME, SETTING_THRESHOLD, SETTING_BEEPS, SETTING_RESPONSES, SETTING_WELCOME, SETTING_VOICE,
+           SETTING_COUNT };
+    int settings[SETTING_COUNT];     // last value sent for each SETTING_*
+    unsigned char settingsknown;     // bit 1<<SETTING_* is set while MOVI is known to have settings[SETTING_*]
+    unsigned int settinghandles[SETTING_COUNT]; // sendCommandAsync() handle of a setting sent from loop(), 0 if none
+    void sendSetting(unsigned char setting, int value, const char *command, const char *parameter);
+    bool hasSetting(unsigned char setting, int value); // true if MOVI is known to have value already
+    void noteSetting(unsigned char setting, int value, bool ok); // updates the shadow after sending value
+    void forgetSetting(unsigned char setting); // MOVI might have any value now
+    
+    // poll() parses MOVI's output byte by byte into fixed buffers so that no event needs the heap.
+    enum { PARSE_PREFIX, PARSE_EVENTNO, PARSE_SEPARATOR, PARSE_PAYLOAD, PARSE_SENTENCENO, PARSE_REJECT };
+    char linebuf[MOVI_LINE_MAX+1];   // stores the current line of serial communication characters
+    unsigned int linelen;            // number of characters in linebuf
+    unsigned char parsestate;        // one of the PARSE_* states above
+    unsigned char prefixpos;         // number of characters of "MOVIEvent[" matched so far
+    bool eventline;                  // true once "MOVIEvent[" has been seen in the current line
+    bool linedone;                   // true when linebuf holds a complete line, reset by the next character
+    bool linecontent;                // true once the current line has a character that isn't whitespace
+    bool lineoverflow;               // true once the current line didn't fit linebuf
+    unsigned long droppedlines;      // see getDroppedLines()
+    unsigned long oversizedlines;    // see getOversizedLines()
+    void countLine(unsigned long *counter); // increments one of the two, which loop() reads while the reader thread counts
+    int parseeventno;                // event number as parsed from MOVIEvent[NNN]
+    int parsesentenceno;             // sentence number as parsed from #N
+    unsigned int payloadstart;       // index in linebuf after the first space
+    int sentencestart;               // index in linebuf after the first '#', -1 if none
+    char result[MOVI_LINE_MAX+1];    // stores the last result for getResult()
+    void resetParser();              // prepares the parser for a new line
+    bool parseChar(char c);          // consumes one character, returns true when a line is complete
+    signed int decodeEvent(char *out); // turns a completed MOVIEvent line into poll()'s return value and its result
+    signed int finishEvent(signed int event); // compares password events with the passkey
+    MOVIHandler *sentencehandlers;   // indexed by sentence number-1, grows to the highest registered sentence
+    unsigned int sentencehandlerslots;
+    MOVIHandler *eventhandlers;      // indexed by event number-100, grows to the highest registered event
+    unsigned int eventhandlerslots;
+    MOVIHandler otherhandler;
+    unsigned long eventtime;         // micros() when the line of the last event arrived
+#ifdef RASPBERRYPI
+    struct EventRecord {
+        signed int event;
+        unsigned long time;
+        char result[MOVI_LINE_MAX+1];
+    };
+    EventRecord eventqueue[MOVI_EVENT_QUEUE]; // single producer (reader thread), single consumer (poll())
+    unsigned int queuehead;          // next record for poll(), only written by poll()
+    unsigned int queuetail;          // next free record, only written by the reader thread
+    bool readerrunning;              // reader thread owns the serial port
+    pthread_t readerthread;
+    void pushEvent(unsigned long time); // queues the completed line, drops it if it isn't MOVI's or the queue is full
+    void answerQueued();             // resolves commands with answers in the queue, leaving the other events there
+    static void *readerMain(void *movi);
+    char **phrases;                  // interned phrases, indexed by id-1
+    unsigned int phrasecount;
+    unsigned int phraseslots;
+    unsigned int *phraseindex;       // open addressing hash table of ids, 0 is free, at most half full
+    unsigned int phraseindexslots;
+    int *sentenceids;                // phrase id of every added sentence, indexed by sentence number-1
+    unsigned int sentencecount;
+    unsigned int sentenceidslots;
+    signed int resultevent;          // event of the last result
+    int resultid;                    // phrase id of the last result, -1 until getResultId() looked it up
+    unsigned int findPhrase(const char *phrase, unsigned int hash); // slot of phrase or of the free slot for it
+    int lookupPhrase(const char *phrase); // id of phrase, 0 if it isn't interned
+    void addSentenceId(const char *sentence); // interns an added sentence under the next sentence number
+#endif
+    
+    String getShieldResponse(unsigned long timeout=MOVI_RESPONSE_TIMEOUT); // used to communicate with the shield before poll(), "" on timeout
+    bool responsetimedout;           // see timedOut()
+    void waitSerial(unsigned long timeout); // waits at most timeout milliseconds for input from MOVI
+    
+    struct PendingCommand {
+        unsigned int handle;
+        unsigned char status;        // one of the COMMAND_* states
+        const char *okresponse;
+        unsigned long sent;          // millis() when it was sent
+        unsigned long timeout;
+    };
+    PendingCommand commands[MOVI_COMMAND_QUEUE]; // indexed by handle%MOVI_COMMAND_QUEUE
+    unsigned int firstcommand;       // handle of the oldest command waiting for its answer
+    unsigned int nextcommand;        // handle of the next command, the ones in between are outstanding
+    int commandfailures;             // failed or timed out commands since the last waitCommands()
+    bool answerCommand(int eventno, const char *line); // resolves the oldest command if the line answers it
+    void finishCommand(unsigned char status); // resolves the oldest command
+    void expireCommands();           // times out the oldest commands whose time is up
+    void drainCommands();            // waits until no command is outstanding
+    void waitCommand();              // waits a little for answers, keeping other events for poll() on the Raspberry Pi
+    const char *answerText();        // text of the completed line after "MOVIEvent[NNN]: "
+    void sendLoopCommand(const char *command, const char *parameter); // sends without waiting, queued if need be
+    signed int readEvent();          // poll() without assuming that setup() is over
+    bool readLine(unsigned long timeout); // reads until linebuf holds a line that isn't blank, false on timeout
+    
+    int ackwindow;          // number of ADDSENTENCE commands that may wait for acknowledgment
+    int outstanding;        // number of ADDSENTENCE commands waiting for acknowledgment
+    int sentencesacked;     // number of sentences acknowledged or failed so far
+    int sentencefailures;   // number of sentences MOVI did not acknowledge
+    bool *failedlist;       // per-sentence failures of the running addSentences() call, NULL otherwise
+    int failedbase;         // value of sentencesacked when addSentences() started
+    bool beginSentence();   // sends NEWSENTENCES once and makes room in the ack window
+    void sendSentence(const char *sentence); // sends ADDSENTENCE without waiting for the acknowledgment
+#ifdef RASPBERRYPI
+    const char *trainingcache;  // file storing the fingerprint of the trained set, NULL if disabled
+    String trainingcachepath;   // holds the resolved path trainingcache points to
+    String pendingsentences;    // sentences collected for train(), one per line
+    String callsignname;        // callsign as part of the fingerprint
+    bool queueSentence(const char *sentence); // collects a sentence for train()
+    bool uploadSentences();     // sends the collected sentences
+#endif
+    void collectAcks(int maxoutstanding); // reads acknowledgments until no more than maxoutstanding are left
     
-    bool sendCommand(String command, String parameter, String okresponse); // sends a command and listens to responses. Only works before poll().
+    bool sendCommand(String command, String parameter, String okresponse, unsigned long timeout=MOVI_RESPONSE_TIMEOUT); // sends a command and listens to responses. Only works before poll().
 
     // Sends a command manually to MOVI. Flash memory version for AVR
-    bool sendCommand(const __FlashStringHelper* command, const __FlashStringHelper* parameter, String okresponse);
+    bool sendCommand(const __FlashStringHelper* command, const __FlashStringHelper* parameter, String okresponse,
+                     unsigned long timeout=MOVI_RESPONSE_TIMEOUT);
 };
 
 
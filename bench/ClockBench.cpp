@@ -0,0 +1,42 @@
+/*
+  ClockBench - Cost of millis() and micros() per call.
+
+  Dialog loops timestamp every event, so these have to stay cheap. With
+  CLOCK_MONOTONIC they are served by the vDSO without a syscall. Run with
+  PIDUINO_SYSTEM_TIMER set to read the BCM system timer on a Raspberry Pi.
+  clock_gettime() and gettimeofday() are timed alongside for reference.
+*/
+
+#include <sys/time.h>
+#include "bench.h"
+
+#define CALLS 10000000L
+
+int main()
+{
+    printf("ClockBench: ns per call, %ld calls each\n", CALLS);
+    printf("  millis()                %6.1f\n", benchNs([](long) { benchSink += millis(); }, CALLS));
+    printf("  micros()                %6.1f\n", benchNs([](long) { benchSink += micros(); }, CALLS));
+    printf("  clock_gettime(MONOTONIC)%6.1f\n", benchNs([](long) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        benchSink += ts.tv_nsec;
+    }, CALLS));
+    printf("  gettimeofday()          %6.1f\n", benchNs([](long) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        benchSink += tv.tv_usec;
+    }, CALLS));
+
+    // micros() must never run backwards
+    unsigned long last = micros();
+    for (long i = 0; i < CALLS / 10; i++) {
+        unsigned long now = micros();
+        if ((long)(now - last) < 0) {
+            printf("micros() went backwards: %lu after %lu\n", now, last);
+            return 1;
+        }
+        last = now;
+    }
+    return 0;
+}
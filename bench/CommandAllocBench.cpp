@@ -0,0 +1,106 @@
+/*
+  CommandAllocBench - String allocations per MOVI::sendCommand().
+
+  Sends commands the way a sketch does from loop() to a pseudo terminal
+  standing in for MOVI, and counts the allocate/reallocate calls Strings
+  make (see getStringAllocStats()). The bench target builds it twice: as
+  CommandAllocBench with the inline buffer of STRING_SSO_SIZE characters,
+  and as CommandAllocBenchNoSSO with STRING_SSO_SIZE 1, where every
+  non-empty String is on the heap.
+*/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "MOVIShield.h"
+#include "bench.h"
+
+#define CALLS 1000
+
+static int master = -1;
+
+// Plays MOVI on the other end of the pty: answers INIT and PING like the
+// board and every other command with OK.
+static void *fakeMovi(void *)
+{
+    char line[256];
+    size_t len = 0;
+    char ch;
+    while (read(master, &ch, 1) == 1) {
+        if (ch != '\n') {
+            if (ch != '\r' && len < sizeof(line) - 1) line[len++] = ch;
+            continue;
+        }
+        line[len] = '\0';
+        if (len == 0) continue;
+        const char *answer = "MOVIEvent[100]: OK\r\n";
+        if (strncmp(line, "INIT", 4) == 0) answer = "MOVIEvent[100]: 1.10 @1.0\r\n";
+        else if (strncmp(line, "PING", 4) == 0) answer = "MOVIEvent[100]: PONG\r\n";
+        if (write(master, answer, strlen(answer)) < 0) break;
+        len = 0;
+    }
+    return NULL;
+}
+
+// Lets poll() pick up the answers, so commands queued by sendCommandAsync() don't pile up.
+static void answer(MOVI &recognizer, HardwareSerial &port)
+{
+    usleep(200);
+    do recognizer.poll(); while (port.available() > 0);
+}
+
+// Only the allocations of f() count, not those of answering it.
+template <class F> static void count(const char *what, MOVI &recognizer, HardwareSerial &port, F f)
+{
+    unsigned long calls = 0, heapcalls = 0;
+    for (int i = 0; i < CALLS; i++) {
+        StringAllocStats before, after;
+        getStringAllocStats(before);
+        f(i);
+        getStringAllocStats(after);
+        calls += after.calls - before.calls;
+        heapcalls += after.heapCalls - before.heapCalls;
+        answer(recognizer, port);
+    }
+    printf("  %-46s %5.1f %5.1f\n", what, (double)calls / CALLS, (double)heapcalls / CALLS);
+}
+
+int main()
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+        perror("posix_openpt");
+        return 1;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, fakeMovi, NULL);
+    unsetenv("MOVI_SERIAL"); // setDevice() would take that instead of the pty
+    HardwareSerial port;
+    port.setDevice(ptsname(master));
+    if (!port.begin(9600)) return 1;
+    MOVI recognizer(false, &port);
+    recognizer.init();
+    if (!recognizer.isReady()) {
+        printf("CommandAllocBench: init() failed\n");
+        return 1;
+    }
+    recognizer.poll(); // from now on commands are sent like from loop()
+
+    printf("CommandAllocBench: String allocations per call, STRING_SSO_SIZE %d\n", STRING_SSO_SIZE);
+    printf("  %-46s %5s %5s\n", "", "all", "heap");
+    count("sendCommand(String(\"SAY\"), String(\"hello\"))", recognizer, port, [&](int) {
+        recognizer.sendCommand(String("SAY"), String("hello"));
+    });
+    count("sendCommand(F(\"VOLUME\"), F(\"80\"))", recognizer, port, [&](int) {
+        recognizer.sendCommand(F("VOLUME"), F("80"));
+    });
+    count("setVolume(80), setVolume(81)", recognizer, port, [&](int i) {
+        recognizer.setVolume(80 + i % 2); // the same value again would not be sent
+    });
+    count("say(String(<41 characters>))", recognizer, port, [&](int) {
+        recognizer.say(String("the lights in the living room are now on!"));
+    });
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+  NumberFormatBench - Round trips and cost of number formatting and parsing.
+
+  setVolume(), setThreshold() and every numeric print() format integers,
+  dtostrf() and print(double) format floats, and init() parses MOVI's
+  firmware version. First checks each formatter against the C library and
+  that what it prints parses back to the same value, then times them.
+*/
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "bench.h"
+
+#define CHECKS 1000000L
+#define CALLS 5000000L
+#define VALUES 4096
+
+// Collects what is printed, so print() can be checked and timed without a port
+class BufferPrint : public Print {
+public:
+    char text[64];
+    size_t len;
+    BufferPrint() : len(0) {}
+    size_t write(uint8_t ch) { return write(&ch, 1); }
+    size_t write(const uint8_t *buffer, size_t size) {
+        if (len + size >= sizeof(text)) len = 0;
+        memcpy(text + len, buffer, size);
+        len += size;
+        text[len] = '\0';
+        return size;
+    }
+};
+
+static uint64_t seed = 1;
+
+static uint64_t random64()
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed ^ (seed >> 29);
+}
+
+static bool fail(const char *what, const char *got, const char *expected)
+{
+    printf("%s: got \"%s\", expected \"%s\"\n", what, got, expected);
+    return false;
+}
+
+static bool checkIntegers()
+{
+    static const long edges[] = { 0, 1, -1, 9, 10, 99, 100, 999999999, 1000000000, LONG_MAX, LONG_MIN, INT_MAX, INT_MIN };
+    char got[32], expected[32];
+    for (long n = 0; n < CHECKS; n++) {
+        long value = n < (long)(sizeof(edges) / sizeof(edges[0])) ? edges[n] : (long)random64() >> (random64() % (8 * sizeof(long)));
+        snprintf(expected, sizeof(expected), "%ld", value);
+        if (strcmp(ltoa(value, got, 10), expected)) return fail("ltoa", got, expected);
+        snprintf(expected, sizeof(expected), "%lu", (unsigned long)value);
+        if (strcmp(ultoa(value, got, 10), expected)) return fail("ultoa", got, expected);
+        if ((long)(int)value == value) {
+            snprintf(expected, sizeof(expected), "%d", (int)value);
+            if (strcmp(itoa(value, got, 10), expected)) return fail("itoa", got, expected);
+        }
+        BufferPrint out;
+        out.print(value);
+        snprintf(expected, sizeof(expected), "%ld", value);
+        if (strcmp(out.text, expected)) return fail("print(long)", out.text, expected);
+        ltoa(value, got, 10);
+        if (strntod(got, strlen(got), NULL) != (double)value) return fail("strntod", got, "the same number");
+    }
+    return true;
+}
+
+// What dtostrf() prints must parse back to within half a unit of its last
+// decimal, give or take the rounding of the test itself
+static bool checkFloats()
+{
+    char got[64], expected[64];
+    for (long n = 0; n < CHECKS; n++) {
+        double value = (double)((int64_t)(random64() % 2000000000) - 1000000000) / pow(10, random64() % 10);
+        unsigned char prec = random64() % 7;
+        dtostrf(value, 0, prec, got);
+        double parsed = strtod(got, NULL);
+        if (fabs(parsed - value) > 0.5 * pow(10, -prec) + 4 * DBL_EPSILON * fabs(value)) {
+            snprintf(expected, sizeof(expected), "%.*f", prec, value);
+            return fail("dtostrf", got, expected);
+        }
+        // 17 significant digits give the same double back
+        snprintf(expected, sizeof(expected), "%.17g", value);
+        if (strntod(expected, strlen(expected), NULL) != value) return fail("strntod(%.17g)", expected, "the same double");
+        snprintf(expected, sizeof(expected), "%.*f", prec, value);
+        if (strntod(expected, strlen(expected), NULL) != strtod(expected, NULL)) return fail("strntod", expected, "what strtod() parses");
+    }
+    return true;
+}
+
+int main()
+{
+    if (!checkIntegers() || !checkFloats()) return 1;
+
+    static long integers[VALUES];
+    static double floats[VALUES];
+    static char versions[VALUES][16];
+    for (int i = 0; i < VALUES; i++) {
+        integers[i] = (long)(random64() % 200000000) - 100000000;
+        floats[i] = (random64() % 10000000) / 1000.0;
+        snprintf(versions[i], sizeof(versions[i]), "%u.%02u", (unsigned)(random64() % 10), (unsigned)(random64() % 100));
+    }
+    char buffer[64];
+    BufferPrint out;
+    printf("NumberFormatBench: ns per call, %ld calls each\n", CALLS);
+    printf("  ltoa()                  %6.1f\n", benchNs([&](long i) {
+        benchSink += ltoa(integers[i % VALUES], buffer, 10)[0];
+    }, CALLS));
+    printf("  snprintf(\"%%ld\")         %6.1f\n", benchNs([&](long i) {
+        benchSink += snprintf(buffer, sizeof(buffer), "%ld", integers[i % VALUES]);
+    }, CALLS));
+    printf("  print(unsigned long)    %6.1f\n", benchNs([&](long i) {
+        benchSink += out.print((unsigned long)integers[i % VALUES]);
+    }, CALLS));
+    printf("  dtostrf(x, 8, 2)        %6.1f\n", benchNs([&](long i) {
+        benchSink += dtostrf(floats[i % VALUES], 8, 2, buffer)[0];
+    }, CALLS));
+    printf("  snprintf(\"%%8.2f\")       %6.1f\n", benchNs([&](long i) {
+        benchSink += snprintf(buffer, sizeof(buffer), "%8.2f", floats[i % VALUES]);
+    }, CALLS));
+    printf("  print(double, 2)        %6.1f\n", benchNs([&](long i) {
+        benchSink += out.print(floats[i % VALUES], 2);
+    }, CALLS));
+    printf("  atof(\"1.10\")            %6.1f\n", benchNs([&](long i) {
+        benchSink += (long)atof(versions[i % VALUES]);
+    }, CALLS));
+    printf("  strntod(\"1.10\")         %6.1f\n", benchNs([&](long i) {
+        const char *s = versions[i % VALUES];
+        benchSink += (long)strntod(s, strlen(s), NULL);
+    }, CALLS));
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*
+  StringAppendBench - Building a 1-4KB String one character at a time.
+
+  This is how poll() and getShieldResponse() used to collect MOVI's
+  answers. concat() grows the capacity by half when it runs out, so the
+  number of reallocations grows with the logarithm of the length. For
+  comparison the same Strings are built with reserve(length() + 1) before
+  every character, which grows them to the exact size each time like
+  concat() used to.
+*/
+
+#include "bench.h"
+
+#define STRINGS 2000
+
+template <class F> static void build(const char *what, unsigned int size, F append)
+{
+    StringAllocStats before, after;
+    getStringAllocStats(before);
+    double ns = benchNs([&](long) {
+        String s;
+        for (unsigned int i = 0; i < size; i++) append(s, (char)('a' + i % 26));
+        benchSink += s.length();
+    }, STRINGS);
+    getStringAllocStats(after);
+    // benchNs() runs STRINGS / 10 more to warm up
+    double calls = (double)(after.calls - before.calls) / (STRINGS + STRINGS / 10);
+    printf("  %4uB  %-14s %8.1fus %7.0f allocs\n", size, what, ns / 1000, calls);
+}
+
+int main()
+{
+    printf("StringAppendBench: per String, %d Strings each\n", STRINGS);
+    for (unsigned int size = 1024; size <= 4096; size *= 2) {
+        build("exact growth", size, [](String &s, char c) {
+            s.reserve(s.length() + 1);
+            s += c;
+        });
+        build("operator+=", size, [](String &s, char c) {
+            s += c;
+        });
+    }
+
+    // shrink_to_fit() gives the slack back and must keep the contents
+    String s;
+    for (int i = 0; i < 1000; i++) s += (char)('a' + i % 26);
+    String copy = s;
+    s.shrink_to_fit();
+    if (s != copy) {
+        printf("shrink_to_fit() changed the String\n");
+        return 1;
+    }
+    return 0;
+}
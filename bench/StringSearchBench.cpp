@@ -0,0 +1,105 @@
+/*
+  StringSearchBench - Keyword search in 20-200 byte recognition results.
+
+  Word spotting sketches run getResult().indexOf(KEYWORD) for dozens of
+  keywords against every RAW_WORDS result. This looks for 24 keywords,
+  a few of which occur, in results of 20, 60 and 200 bytes. memfind() is
+  also checked against a plain search on random input first.
+*/
+
+#include <stdint.h>
+#include "StringView.h"
+#include "bench.h"
+
+#define SEARCHES 2000000L
+#define CHECKS 200000L
+#define KEYWORDS 24
+
+static const char *words[] = {
+    "LIGHTS", "ON", "OFF", "THE", "KITCHEN", "PLEASE", "TURN", "IN", "LIVING", "ROOM",
+    "BEDROOM", "MUSIC", "LOUDER", "STOP", "WHAT", "TIME", "IS", "IT", "OPEN", "DOOR",
+};
+
+static const char *keywords[KEYWORDS] = {
+    "KITCHEN", "GARAGE", "WINDOW", "HEATER", "TEMPERATURE", "ALARM", "LAMP", "FAN",
+    "COFFEE", "GARDEN", "OVEN", "RADIO", "TELEVISION", "CURTAIN", "SPRINKLER", "DOORBELL",
+    "MUSIC", "BASEMENT", "ATTIC", "PORCH", "CAMERA", "LOCK", "SHOWER", "DOOR",
+};
+
+static uint64_t seed = 1;
+
+static unsigned int random32()
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed >> 33;
+}
+
+static const char *naiveFind(const char *haystack, size_t haystacklen, const char *needle, size_t needlelen)
+{
+    if (needlelen > haystacklen) return NULL;
+    for (size_t i = 0; i + needlelen <= haystacklen; i++) {
+        if (memcmp(haystack + i, needle, needlelen) == 0) return haystack + i;
+    }
+    return NULL;
+}
+
+// memfind() must agree with the plain search, matches near the ends included
+static bool check()
+{
+    char haystack[300], needle[8];
+    for (long n = 0; n < CHECKS; n++) {
+        size_t haystacklen = random32() % 300, needlelen = 1 + random32() % 8;
+        for (size_t i = 0; i < haystacklen; i++) haystack[i] = 'a' + random32() % 3;
+        for (size_t i = 0; i < needlelen; i++) needle[i] = 'a' + random32() % 3;
+        if (memfind(haystack, haystacklen, needle, needlelen) != naiveFind(haystack, haystacklen, needle, needlelen)) {
+            printf("memfind() disagrees with a plain search: needle %.*s in %.*s\n",
+                (int)needlelen, needle, (int)haystacklen, haystack);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    if (!check()) return 1;
+    String needles[KEYWORDS];
+    for (int k = 0; k < KEYWORDS; k++) needles[k] = keywords[k];
+
+    printf("StringSearchBench: ns per search, %d keywords\n", KEYWORDS);
+    printf("  %-22s %7s %7s %7s\n", "", "20B", "60B", "200B");
+    const char *names[] = { "plain loop", "memmem()", "memfind()", "String::indexOf", "StringView::indexOf" };
+    double ns[5][3];
+    const unsigned int sizes[3] = { 20, 60, 200 };
+    for (int j = 0; j < 3; j++) {
+        String result;
+        while (result.length() < sizes[j]) {
+            if (result.length()) result += ' ';
+            result += words[random32() % (sizeof(words) / sizeof(words[0]))];
+        }
+        result.remove(sizes[j]);
+        const char *r = result.c_str();
+        size_t rlen = result.length();
+        StringView view(result);
+        ns[0][j] = benchNs([&](long i) {
+            const String &k = needles[i % KEYWORDS];
+            benchSink += naiveFind(r, rlen, k.c_str(), k.length()) != NULL;
+        }, SEARCHES);
+        ns[1][j] = benchNs([&](long i) {
+            const String &k = needles[i % KEYWORDS];
+            benchSink += memmem(r, rlen, k.c_str(), k.length()) != NULL;
+        }, SEARCHES);
+        ns[2][j] = benchNs([&](long i) {
+            const String &k = needles[i % KEYWORDS];
+            benchSink += memfind(r, rlen, k.c_str(), k.length()) != NULL;
+        }, SEARCHES);
+        ns[3][j] = benchNs([&](long i) {
+            benchSink += result.indexOf(needles[i % KEYWORDS]);
+        }, SEARCHES);
+        ns[4][j] = benchNs([&](long i) {
+            benchSink += view.indexOf(StringView(needles[i % KEYWORDS]));
+        }, SEARCHES);
+    }
+    for (int i = 0; i < 5; i++) printf("  %-22s %7.1f %7.1f %7.1f\n", names[i], ns[i][0], ns[i][1], ns[i][2]);
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+  bench.h - Helpers for the piduino_light benchmarks in this directory.
+
+  The benchmarks are plain programs with their own main(). They are built
+  from the library sources without piduinowrapper.cpp, so they run without
+  a console or a MOVI attached. Build and run all of them with "make bench".
+*/
+
+#ifndef bench_h
+#define bench_h
+
+#include <stdio.h>
+#include <time.h>
+#include "Arduino.h"
+
+// piduinowrapper.cpp, which holds main(), is left out, so the ports live here
+// and there is no reactor.
+HardwareSerial Serial;
+HardwareSerial Serial1;
+uint8_t reactorActive() { return 0; }
+
+// Results are added here so the compiler can't drop the work being timed.
+volatile long benchSink;
+
+static inline double benchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Calls f(i) for i from 0 to n-1 and returns the nanoseconds per call.
+// One untimed round beforehand warms up caches and branch predictors.
+template <class F> double benchNs(F f, long n)
+{
+    for (long i = 0; i < n / 10; i++) f(i);
+    double start = benchNow();
+    for (long i = 0; i < n; i++) f(i);
+    return (benchNow() - start) / n;
+}
+
+#endif
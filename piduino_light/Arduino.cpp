@@ -25,6 +25,83 @@
 #include "Arduino.h"
 #include "sysfsio.h"
 #include <errno.h>
+#include <pthread.h>
+
+#define SYSTEM_TIMER_OFFSET 0x3000  // BCM system timer registers relative to the peripheral base
+#define SYSTEM_TIMER_CLO 1          // lower 32 bits of the free running 1MHz counter
+#define SYSTEM_TIMER_CHI 2          // upper 32 bits
+
+static pthread_once_t timeinit = PTHREAD_ONCE_INIT;
+static uint64_t timeorigin;                     // microseconds at program start
+static volatile uint32_t *systemtimer = NULL;   // mapped BCM system timer, NULL if not used
+
+// Reads the peripheral base address the same way bcm_host_get_peripheral_address() does.
+static unsigned long peripheralBase()
+{
+	unsigned char ranges[12];
+	unsigned long base = 0;
+	FILE *fp = fopen("/proc/device-tree/soc/ranges", "rb");
+	if (fp == NULL) return 0;
+	size_t n = fread(ranges, 1, sizeof(ranges), fp);
+	fclose(fp);
+	if (n >= 8) base = ((unsigned long)ranges[4] << 24) | (ranges[5] << 16) | (ranges[6] << 8) | ranges[7];
+	if (base == 0 && n >= 12) base = ((unsigned long)ranges[8] << 24) | (ranges[9] << 16) | (ranges[10] << 8) | ranges[11];
+	return base;
+}
+
+static void mapSystemTimer()
+{
+	unsigned long base = peripheralBase();
+	if (base == 0) {
+		fprintf(stderr,"Pi: Peripheral base unknown. Using CLOCK_MONOTONIC.\n");
+		return;
+	}
+	int fd = open("/dev/mem", O_RDONLY | O_SYNC);
+	if (fd == -1) {
+		fprintf(stderr,"Pi: Failed to open /dev/mem: %s. Using CLOCK_MONOTONIC.\n", strerror(errno));
+		return;
+	}
+	void *map = mmap(NULL, 4096, PROT_READ, MAP_SHARED, fd, base + SYSTEM_TIMER_OFFSET);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr,"Pi: Failed to map system timer: %s. Using CLOCK_MONOTONIC.\n", strerror(errno));
+		return;
+	}
+	systemtimer = (volatile uint32_t *)map;
+}
+
+static inline uint64_t clockMicros()
+{
+	if (systemtimer) {
+		uint32_t hi, lo;
+		do {
+			hi = systemtimer[SYSTEM_TIMER_CHI];
+			lo = systemtimer[SYSTEM_TIMER_CLO];
+		} while (hi != systemtimer[SYSTEM_TIMER_CHI]); // CLO wrapped in between
+		return ((uint64_t)hi << 32) | lo;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts); // served from the vDSO, no syscall
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void initTime()
+{
+	if (getenv("PIDUINO_SYSTEM_TIMER")) mapSystemTimer();
+	timeorigin = clockMicros();
+}
+
+unsigned long micros()
+{
+	pthread_once(&timeinit, initTime); // threads see timeorigin set before they read it
+	return (unsigned long)(clockMicros() - timeorigin);
+}
+
+unsigned long millis()
+{
+	pthread_once(&timeinit, initTime);
+	return (unsigned long)((clockMicros() - timeorigin) / 1000);
+}
 
 void sleepMicroseconds(uint32_t m) {
   usleep(m);
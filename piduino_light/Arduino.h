@@ -122,13 +122,16 @@ void yield(void);
 
 #define bit(b) (1UL << (b))
 
-#define micros() (unsigned long)(STCV)
-#define millis() (unsigned long)(STCV / 1000)
-
 typedef unsigned int word;
 typedef uint8_t boolean;
 typedef uint8_t byte;
 
+// Time since program start, taken from CLOCK_MONOTONIC. If the environment
+// variable PIDUINO_SYSTEM_TIMER is set and /dev/mem can be mapped, the
+// 1MHz BCM system timer is read directly instead.
+unsigned long millis(void);
+unsigned long micros(void);
+
 //under millisecond delayMicroseconds halts the CPU
 void delayMicroseconds(uint32_t m);
 void delay(uint32_t m);
@@ -158,6 +161,21 @@ void detachInterrupt(uint8_t);
 void setup(void);
 void loop(void);
 
+// Reactor mode, must be enabled in setup(). Instead of calling loop() over and
+// over, the wrapper sleeps until the MOVI serial port or the console has input,
+// a registered file descriptor is readable or a timer is due. loop() is then
+// called once; input it leaves unread doesn't wake it again, only new input does.
+// Registered callbacks are called instead of loop(); a NULL callback calls loop().
+// reactorMode() returns 0 if a reader thread owns a serial port (see
+// HardwareSerial::setReaderThread()), the add functions return an id or -1 if
+// all slots are taken.
+#define REACTOR_MAX_TIMERS 8
+#define REACTOR_MAX_FDS 8
+uint8_t reactorMode(uint8_t on);
+uint8_t reactorActive(void);
+int reactorAddTimer(unsigned long interval, voidFuncPtr callback);
+int reactorAddFd(int fd, voidFuncPtr callback);
+
 
 #ifdef __cplusplus
 } // extern "C"
@@ -166,6 +184,7 @@ void loop(void);
 #ifdef __cplusplus
 #include "WCharacter.h"
 #include "WString.h"
+#include "StringView.h"
 #include "HardwareSerial.h"
 
 uint16_t makeWord(uint16_t w);
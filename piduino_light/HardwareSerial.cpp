@@ -31,11 +31,18 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 
 HardwareSerial::HardwareSerial()
 {
     _deviceName="/dev/tty";
     _istty=true;
+    _device=-1;
+    _rxpos=0;
+    _rxlen=0;
+    _txlen=0;
+    _flushpolicy=SERIAL_FLUSH_NEWLINE;
+    _readerthread=false;
 }
 
 
@@ -69,48 +76,201 @@ void HardwareSerial::end()
 
 void HardwareSerial::flush()
 {
+    flushBuffer(NULL, 0);
     tcdrain(_device);
 }
 
+void HardwareSerial::setFlushPolicy(uint8_t policy)
+{
+    _flushpolicy = policy;
+    if (_flushpolicy == SERIAL_FLUSH_IMMEDIATE)
+	flushBuffer(NULL, 0);
+}
+
+uint8_t HardwareSerial::getFlushPolicy()
+{
+    return _flushpolicy;
+}
+
 int HardwareSerial::peek(void)
 {
-    fprintf(stderr, "HardwareSerial::peek not implemented\n");
-    return 0;
+    if (_txlen)
+	flushBuffer(NULL, 0);
+    if (_rxpos == _rxlen && available() == 0)
+	return -1;
+    return _rxbuf[_rxpos];
 }
 
 int HardwareSerial::available()
 {
     int bytes;
 
+    if (_rxpos < _rxlen)
+	return _rxlen - _rxpos;
+    if (_txlen)
+	flushBuffer(NULL, 0);
     if (ioctl(_device, FIONREAD, &bytes) != 0)
     {
 	fprintf(stderr, "HardwareSerial::available ioctl failed: %s\n", strerror(errno));
 	return 0;
     }
-    return bytes;
+    if (bytes > 0)
+	return fillBuffer(bytes);
+    return 0;
 }
 
 int HardwareSerial::read()
 {
-    uint8_t data;
-    ssize_t result = ::read(_device, &data, 1);
-    if (result != 1)
+    if (_txlen)
+	flushBuffer(NULL, 0);
+    if (_rxpos == _rxlen && fillBuffer(SERIAL_RX_BUFFER_SIZE) == 0)
+	return 0;
+    return _rxbuf[_rxpos++];
+}
+
+int HardwareSerial::receive()
+{
+    int bytes;
+
+    if (_device == -1)
+	return 0;
+    if (_rxpos > 0)
+    {
+	memmove(_rxbuf, _rxbuf + _rxpos, _rxlen - _rxpos);
+	_rxlen -= _rxpos;
+	_rxpos = 0;
+    }
+    if (_rxlen == SERIAL_RX_BUFFER_SIZE || ioctl(_device, FIONREAD, &bytes) != 0 || bytes == 0)
+	return _rxlen;
+    if (bytes > SERIAL_RX_BUFFER_SIZE - _rxlen)
+	bytes = SERIAL_RX_BUFFER_SIZE - _rxlen;
+    ssize_t result = ::read(_device, _rxbuf + _rxlen, bytes);
+    if (result > 0)
+	_rxlen += result;
+    return _rxlen;
+}
+
+int HardwareSerial::fillBuffer(int max)
+{
+    if (max > SERIAL_RX_BUFFER_SIZE)
+	max = SERIAL_RX_BUFFER_SIZE;
+    _rxpos = 0;
+    _rxlen = 0;
+    ssize_t result = ::read(_device, _rxbuf, max);
+    if (result < 1)
     {
 	fprintf(stderr, "HardwareSerial::read read failed: %s\n", strerror(errno));
 	return 0;
     }
-    return data;
+    _rxlen = result;
+    return _rxlen;
 }
 
 size_t HardwareSerial::write(uint8_t ch)
 {
-    size_t result = ::write(_device, &ch, 1);
-    if (result != 1)
+    return write(&ch, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    if (_txlen + size > SERIAL_TX_BUFFER_SIZE)
+    {
+	// Does not fit: send what is buffered together with the new data
+	if (!flushBuffer(buffer, size))
+	    return 0;
+	return size;
+    }
+    memcpy(_txbuf + _txlen, buffer, size);
+    _txlen += size;
+    if (_flushpolicy == SERIAL_FLUSH_IMMEDIATE
+	|| (_flushpolicy == SERIAL_FLUSH_NEWLINE && memchr(buffer, '\n', size)))
     {
-	fprintf(stderr, "HardwareSerial::write failed: %s\n", strerror(errno));
+	if (!flushBuffer(NULL, 0))
+	    return 0;
+    }
+    return size; // OK
+}
+
+size_t HardwareSerial::println(void)
+{
+    return write((const uint8_t *)"\r\n", 2);
+}
+
+size_t HardwareSerial::vprintf(const char *format, va_list arg)
+{
+    // When the buffer is nearly full a line is unlikely to fit: format it on
+    // the stack and let write() send both with one writev()
+    size_t space = SERIAL_TX_BUFFER_SIZE - _txlen;
+    if (space < SERIAL_TX_BUFFER_SIZE / 4)
+	return Print::vprintf(format, arg);
+    va_list copy;
+    va_copy(copy, arg);
+    int len = vsnprintf((char *)_txbuf + _txlen, space, format, copy);
+    va_end(copy);
+    if (len < 0)
 	return 0;
+    if ((size_t)len >= space)
+    {
+	// Longer than the buffer: write() flushes it chunk by chunk
+	if ((size_t)len >= SERIAL_TX_BUFFER_SIZE)
+	    return vprintfChunked(format, arg);
+	// Fits an empty buffer
+	if (!flushBuffer(NULL, 0))
+	    return 0;
+	vsnprintf((char *)_txbuf, SERIAL_TX_BUFFER_SIZE, format, arg);
     }
-    return 1; // OK
+    uint8_t *added = _txbuf + _txlen;
+    _txlen += len;
+    if (_flushpolicy == SERIAL_FLUSH_IMMEDIATE
+	|| (_flushpolicy == SERIAL_FLUSH_NEWLINE && memchr(added, '\n', len)))
+    {
+	if (!flushBuffer(NULL, 0))
+	    return 0;
+    }
+    return len;
+}
+
+bool HardwareSerial::flushBuffer(const uint8_t *extra, size_t size)
+{
+    struct iovec iov[2];
+    struct iovec *v = iov;
+    int count = 2;
+
+    iov[0].iov_base = _txbuf;
+    iov[0].iov_len = _txlen;
+    iov[1].iov_base = (void *)extra;
+    iov[1].iov_len = size;
+    _txlen = 0;
+    while (count > 0)
+    {
+	if (v->iov_len == 0)
+	{
+	    v++;
+	    count--;
+	    continue;
+	}
+	ssize_t result = writev(_device, v, count);
+	if (result < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    fprintf(stderr, "HardwareSerial::write failed: %s\n", strerror(errno));
+	    return false;
+	}
+	// Skip what has been written, a partial write leaves the rest for the next round
+	while (count > 0 && (size_t)result >= v->iov_len)
+	{
+	    result -= v->iov_len;
+	    v++;
+	    count--;
+	}
+	if (count > 0)
+	{
+	    v->iov_base = (uint8_t *)v->iov_base + result;
+	    v->iov_len -= result;
+	}
+    }
+    return true;
 }
 
 bool HardwareSerial::openDevice()
@@ -133,8 +293,13 @@ bool HardwareSerial::openDevice()
 bool HardwareSerial::closeDevice()
 {
     if (_device != -1)
+    {
+	flushBuffer(NULL, 0);
 	close(_device);
+    }
     _device = -1;
+    _rxpos = 0;
+    _rxlen = 0;
     return true;
 }
 
@@ -253,6 +418,10 @@ bool HardwareSerial::waitAvailableTimeout(uint16_t timeout)
     fd_set         input;
     int            result;
 
+    if (_rxpos < _rxlen)
+	return true;
+    if (_txlen)
+	flushBuffer(NULL, 0);
     FD_ZERO(&input);
     FD_SET(_device, &input);
     max_fd = _device + 1;
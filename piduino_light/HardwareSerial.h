@@ -26,6 +26,19 @@
 #include <stdio.h>
 #include "Stream.h"
 
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 256 // bytes fetched from the device with a single read()
+#endif
+
+#ifndef SERIAL_TX_BUFFER_SIZE
+#define SERIAL_TX_BUFFER_SIZE 256 // bytes coalesced into a single write()
+#endif
+
+// Flush policies for setFlushPolicy()
+#define SERIAL_FLUSH_NEWLINE   0 // transmit as soon as a newline has been written (default)
+#define SERIAL_FLUSH_EXPLICIT  1 // transmit only on flush(), a full buffer or when input is checked
+#define SERIAL_FLUSH_IMMEDIATE 2 // transmit on every write
+
 /////////////////////////////////////////////////////////////////////
 /// \class HardwareSerial HardwareSerial.h <RHutil/HardwareSerial.h>
 /// \brief Encapsulates a Posix compliant serial port as a HarwareSerial
@@ -54,6 +67,14 @@ public:
     void setDevice(const char* deviceName);
     const char *getDevice();
 
+    /// \return The file descriptor of the open device or -1 if the port is closed
+    int getFd() { return _device; }
+
+    /// Marks the port as read by a thread of its own, e.g. MOVI's reader
+    /// thread. Nothing else may read it then, reactorMode() refuses to start.
+    void setReaderThread(bool on) { _readerthread = on; }
+    bool hasReaderThread() { return _readerthread; }
+
     /// Open and configure the port.
     /// The named port is opened, and the given baud rate is set.
     /// The port is configure for raw input and output and 8,N,1 protocol
@@ -71,30 +92,73 @@ public:
     void end();
 
     /// Flush remaining data.
-    /// Blocks until any data yet to be transmtted is sent.
+    /// Hands the transmit buffer to the device and blocks until any data yet
+    /// to be transmtted is sent.
     void flush();
 
-    /// Peek at the nex available character without consuming it.
-    /// CAUTION: Not implemented.
+    /// Selects when the transmit buffer is handed to the device.
+    /// Pending output is always transmitted before input is checked, so a
+    /// prompt is visible before the program waits for the answer.
+    /// \param[in] policy One of SERIAL_FLUSH_NEWLINE, SERIAL_FLUSH_EXPLICIT or SERIAL_FLUSH_IMMEDIATE
+    void setFlushPolicy(uint8_t policy);
+
+    /// Returns the flush policy set by setFlushPolicy().
+    uint8_t getFlushPolicy();
+
+    /// Peek at the next available character without consuming it.
+    /// \return The next available character or -1 if none is available
     int peek(void);
 
     /// Returns the number of bytes immediately available to be read from the
-    /// device.
+    /// device. Bytes are served from the receive buffer, the device is only
+    /// queried once the buffer has been drained.
     /// \return 0 if none available else the number of characters available for immediate reading
     int available();
 
+    /// \return The number of characters in the receive buffer, without asking the device
+    int buffered() { return _rxlen - _rxpos; }
+
+    /// Moves the unread characters to the front of the receive buffer and
+    /// appends what the device has queued, as far as it fits. Doesn't block.
+    /// Afterwards readability of the device means new input, unless the
+    /// buffer is full.
+    /// \return The number of characters in the receive buffer
+    int receive();
+
     /// Read and return the next available character.
-    /// If no character is available prints a message to stderr and returns 0;
+    /// If the receive buffer is empty it is refilled with a single read(), which
+    /// blocks until at least one character arrives.
+    /// If the read fails prints a message to stderr and returns 0;
     /// \return The next available character
     int read();
 
     /// Transmit a single character oin the serial port.
-    /// Returns immediately.
+    /// The character is appended to the transmit buffer, which is sent
+    /// according to the flush policy. Returns immediately.
     /// IO errors are repored by printing aa message to stderr.
     /// \param[in] ch The character to send. Anything in the range 0x00 to 0xff is permitted
     /// \return 1 if successful else 0
     size_t write(uint8_t ch);
 
+    /// Transmit a block of characters on the serial port.
+    /// The block is appended to the transmit buffer. If it does not fit, the
+    /// buffered data and the block are sent together with a single writev().
+    /// \param[in] buffer The characters to send
+    /// \param[in] size The number of characters to send
+    /// \return size if successful else 0
+    size_t write(const uint8_t *buffer, size_t size);
+
+    /// Format straight into the transmit buffer, which is sent according
+    /// to the flush policy. Output that does not fit behind what is already
+    /// buffered is formatted again after sending the buffer; output longer
+    /// than the buffer is sent together with it in a single writev().
+    /// \return The number of characters written
+    size_t vprintf(const char *format, va_list arg);
+
+    /// Terminate a line with \r\n in one buffered write.
+    size_t println(void);
+    using Print::println;
+
     // These are not usually in HardwareSerial but we 
     // need them in a Unix environment
 
@@ -119,12 +183,25 @@ protected:
     bool openDevice();
     bool closeDevice();
     bool setBaud(int baud);
+    /// Refills the empty receive buffer with one read() of at most max bytes.
+    /// \return the number of bytes now buffered
+    int fillBuffer(int max);
+    /// Sends the transmit buffer followed by size bytes of extra data.
+    /// \return true if everything was written
+    bool flushBuffer(const uint8_t *extra, size_t size);
 
 private:
     const char* _deviceName;
     int         _device; // file desriptor
     int         _baud;
     bool        _istty;
+    uint8_t     _rxbuf[SERIAL_RX_BUFFER_SIZE]; // receive buffer
+    int         _rxpos;  // next unread byte in _rxbuf
+    int         _rxlen;  // number of valid bytes in _rxbuf
+    uint8_t     _txbuf[SERIAL_TX_BUFFER_SIZE]; // transmit buffer
+    size_t      _txlen;  // number of bytes waiting in _txbuf
+    uint8_t     _flushpolicy;
+    bool        _readerthread; // set by setReaderThread()
 };
 
 extern HardwareSerial Serial;
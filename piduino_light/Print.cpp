@@ -42,13 +42,49 @@ size_t Print::write(const uint8_t *buffer, size_t size){
 size_t Print::printf(const char *format, ...) {
   va_list arg;
   va_start(arg, format);
-  char temp[4096];
-  size_t len = vsnprintf(temp, 4096, format, arg);
-  len = print(temp);
+  size_t len = vprintf(format, arg);
   va_end(arg);
   return len;
 }
 
+size_t Print::vprintf(const char *format, va_list arg) {
+  // Most output fits a small chunk; longer output is streamed
+  char buf[128];
+  va_list copy;
+  va_copy(copy, arg);
+  int len = vsnprintf(buf, sizeof(buf), format, copy);
+  va_end(copy);
+  if (len < 0) return 0;
+  if ((size_t)len < sizeof(buf)) return write((const uint8_t *)buf, len);
+  return vprintfChunked(format, arg);
+}
+
+struct PrintCookie {
+  Print *out;
+  size_t written;
+};
+
+static ssize_t printCookieWrite(void *cookie, const char *buf, size_t size) {
+  PrintCookie *c = (PrintCookie *)cookie;
+  size_t n = c->out->write((const uint8_t *)buf, size);
+  c->written += n;
+  return n;
+}
+
+size_t Print::vprintfChunked(const char *format, va_list arg) {
+  // stdio formats into the chunk and hands it to write() each time it fills,
+  // so output of any length goes out without a temporary of its size
+  char chunk[128];
+  PrintCookie cookie = { this, 0 };
+  cookie_io_functions_t io = { NULL, printCookieWrite, NULL, NULL };
+  FILE *f = fopencookie(&cookie, "w", io);
+  if (f == NULL) return 0;
+  setvbuf(f, chunk, _IOFBF, sizeof(chunk));
+  vfprintf(f, format, arg);
+  fclose(f);
+  return cookie.written;
+}
+
 size_t Print::print(const String &s){
   return write(s.c_str(), s.length());
 }
@@ -79,8 +115,7 @@ size_t Print::print(long n, int base){
   } else if (base == 10) {
     if (n < 0) {
       int t = print('-');
-      n = -n;
-      return printNumber(n, 10) + t;
+      return printNumber(0UL - (unsigned long)n, 10) + t;
     }
     return printNumber(n, 10);
   } else {
@@ -179,6 +214,8 @@ size_t Print::printNumber(unsigned long n, uint8_t base) {
   // prevent crash if called with base == 1
   if (base < 2) base = 10;
 
+  if (base == 10) return write(utoa10(n, str));
+
   do {
     unsigned long m = n;
     n /= base;
@@ -190,43 +227,13 @@ size_t Print::printNumber(unsigned long n, uint8_t base) {
 }
 
 size_t Print::printFloat(double number, uint8_t digits) { 
-  size_t n = 0;
-  
   if (isnan(number)) return print("nan");
   if (isinf(number)) return print("inf");
   if (number > 4294967040.0) return print ("ovf");  // constant determined empirically
   if (number <-4294967040.0) return print ("ovf");  // constant determined empirically
   
-  // Handle negative numbers
-  if (number < 0.0){
-     n += print('-');
-     number = -number;
-  }
-
-  // Round correctly so that print(1.999, 2) prints as "2.00"
-  double rounding = 0.5;
-  for (uint8_t i=0; i<digits; ++i)
-    rounding /= 10.0;
-  
-  number += rounding;
-
-  // Extract the integer part of the number and print it
-  unsigned long int_part = (unsigned long)number;
-  double remainder = number - (double)int_part;
-  n += print(int_part);
-
-  // Print the decimal point, but only if there are digits beyond
-  if (digits > 0) {
-    n += print("."); 
-  }
-
-  // Extract digits from the remainder one at a time
-  while (digits-- > 0){
-    remainder *= 10.0;
-    int toPrint = int(remainder);
-    n += print(toPrint);
-    remainder -= toPrint; 
-  } 
-  
-  return n;
+  // Formatted in one go and correctly rounded, see fixedtoa()
+  char buf[16 + 256];
+  int len = fixedtoa(number, digits, buf);
+  return write((const uint8_t *) buf, len);
 }
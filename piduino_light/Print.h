@@ -22,6 +22,7 @@
 
 #include <inttypes.h>
 #include <stdio.h> // for size_t
+#include <stdarg.h>
 
 #include "WString.h"
 #include "Printable.h"
@@ -38,6 +39,8 @@ class Print{
     size_t printFloat(double, uint8_t);
   protected:
     void setWriteError(int err = 1) { write_error = err; }
+    // Formats in 128 byte chunks, each passed to write() as soon as it fills
+    size_t vprintfChunked(const char *format, va_list arg);
   public:
     Print(): write_error(0) {}
     virtual ~Print(){}
@@ -53,7 +56,10 @@ class Print{
       return write((const uint8_t *)str, strlen(str));
     }
     
-    size_t printf(const char *format, ...);
+    size_t printf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+    // Short output is written with a single write(), longer output in chunks;
+    // a subclass with a buffer of its own can format straight into that instead
+    virtual size_t vprintf(const char *format, va_list arg);
     size_t print(const String &);
     size_t print(const char*);
     size_t print(char);
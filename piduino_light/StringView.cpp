@@ -0,0 +1,143 @@
+/*
+  StringView.cpp - Non-owning view of characters for the Raspberry PI
+  Arduino core used with the MOVI(TM) Arduino Speech Dialog Shield.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "StringView.h"
+#include <limits.h>
+
+/*********************************************/
+/*  Comparison                               */
+/*********************************************/
+
+unsigned char StringView::equalsIgnoreCase(const StringView &s) const
+{
+  if (len != s.len) return 0;
+  for (unsigned int i = 0; i < len; i++) {
+    if (tolower((unsigned char)ptr[i]) != tolower((unsigned char)s.ptr[i])) return 0;
+  }
+  return 1;
+}
+
+/*********************************************/
+/*  Search                                   */
+/*********************************************/
+
+int StringView::indexOf(char ch, unsigned int fromIndex) const
+{
+  if (fromIndex >= len) return -1;
+  const char *found = (const char *)memchr(ptr + fromIndex, ch, len - fromIndex);
+  if (found == NULL) return -1;
+  return found - ptr;
+}
+
+int StringView::indexOf(const StringView &s, unsigned int fromIndex) const
+{
+  if (fromIndex > len) return -1;
+  const char *found = (const char *)memfind(ptr + fromIndex, len - fromIndex, s.ptr, s.len);
+  if (found == NULL) return -1;
+  return found - ptr;
+}
+
+int StringView::lastIndexOf(char ch) const
+{
+  const char *found = (const char *)memrchr(ptr, ch, len);
+  if (found == NULL) return -1;
+  return found - ptr;
+}
+
+/*********************************************/
+/*  Parts                                    */
+/*********************************************/
+
+StringView StringView::substring(unsigned int left, unsigned int right) const
+{
+  if (left > right) {
+    unsigned int temp = right;
+    right = left;
+    left = temp;
+  }
+  if (left > len) return StringView();
+  if (right > len) right = len;
+  return StringView(ptr + left, right - left);
+}
+
+StringView StringView::trim(void) const
+{
+  const char *begin = ptr;
+  const char *end = ptr + len;
+  while (begin < end && isspace((unsigned char)*begin)) begin++;
+  while (end > begin && isspace((unsigned char)end[-1])) end--;
+  return StringView(begin, end - begin);
+}
+
+StringView StringView::split(char separator)
+{
+  int index = indexOf(separator);
+  StringView head;
+  if (index < 0) {
+    head = *this;
+    ptr += len;
+    len = 0;
+  } else {
+    head = StringView(ptr, index);
+    ptr += index + 1;
+    len -= index + 1;
+  }
+  return head;
+}
+
+/*********************************************/
+/*  Parsing / Conversion                     */
+/*********************************************/
+
+unsigned char StringView::toInt(long &value) const
+{
+  StringView s = trim();
+  unsigned int i = 0;
+  unsigned char negative = 0;
+  unsigned long result = 0;
+  unsigned long limit = LONG_MAX;
+  if (i < s.len && (s.ptr[i] == '-' || s.ptr[i] == '+')) negative = s.ptr[i++] == '-';
+  if (negative) limit++;
+  if (i == s.len) return 0;
+  for (; i < s.len; i++) {
+    if (s.ptr[i] < '0' || s.ptr[i] > '9') return 0;
+    unsigned int digit = s.ptr[i] - '0';
+    if (result > (limit - digit) / 10) return 0; // overflow
+    result = result * 10 + digit;
+  }
+  value = negative ? (long)(0 - result) : (long)result;
+  return 1;
+}
+
+unsigned char StringView::toFloat(float &value) const
+{
+  StringView s = trim();
+  size_t used;
+  double result = strntod(s.ptr, s.len, &used);
+  if (used == 0 || used != s.len) return 0;
+  value = (float)result;
+  return 1;
+}
+
+String StringView::toString(void) const
+{
+  String out;
+  if (out.reserve(len)) out.concat(ptr, len);
+  return out;
+}
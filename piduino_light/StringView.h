@@ -0,0 +1,80 @@
+/*
+  StringView.h - Non-owning view of characters for the Raspberry PI
+  Arduino core used with the MOVI(TM) Arduino Speech Dialog Shield.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef StringView_class_h
+#define StringView_class_h
+#ifdef __cplusplus
+
+#include "WString.h"
+
+// A pointer and a length into characters owned by someone else, e.g. a
+// String or a buffer. Nothing is copied or allocated, so a view is only
+// valid as long as what it points to is unchanged. The characters are not
+// NUL-terminated.
+class StringView {
+public:
+  StringView() : ptr(""), len(0) {}
+  StringView(const char *cstr) : ptr(cstr ? cstr : ""), len(cstr ? strlen(cstr) : 0) {}
+  StringView(const char *data, unsigned int length) : ptr(data), len(length) {}
+  StringView(const String &str) : ptr(str.c_str() ? str.c_str() : ""), len(str.length()) {}
+
+  const char *data(void) const { return ptr; }
+  unsigned int length(void) const { return len; }
+  char operator [] (unsigned int index) const { return index < len ? ptr[index] : 0; }
+  const char *begin(void) const { return ptr; }
+  const char *end(void) const { return ptr + len; }
+
+  // comparison
+  unsigned char equals(const StringView &s) const { return len == s.len && memcmp(ptr, s.ptr, len) == 0; }
+  unsigned char equalsIgnoreCase(const StringView &s) const;
+  unsigned char operator == (const StringView &rhs) const { return equals(rhs); }
+  unsigned char operator != (const StringView &rhs) const { return !equals(rhs); }
+  unsigned char startsWith(const StringView &prefix) const
+    { return len >= prefix.len && memcmp(ptr, prefix.ptr, prefix.len) == 0; }
+  unsigned char endsWith(const StringView &suffix) const
+    { return len >= suffix.len && memcmp(ptr + len - suffix.len, suffix.ptr, suffix.len) == 0; }
+
+  // search, -1 if not found
+  int indexOf(char ch, unsigned int fromIndex = 0) const;
+  int indexOf(const StringView &s, unsigned int fromIndex = 0) const;
+  int lastIndexOf(char ch) const;
+
+  // views of a part, nothing is copied
+  StringView substring(unsigned int beginIndex) const { return substring(beginIndex, len); }
+  StringView substring(unsigned int beginIndex, unsigned int endIndex) const;
+  StringView trim(void) const;
+  // returns the part before the first separator and drops it and the
+  // separator from this view; returns everything if there is no separator
+  StringView split(char separator);
+
+  // parsing, returns 0 and leaves value alone if the whole view (apart
+  // from surrounding whitespace) isn't a number
+  unsigned char toInt(long &value) const;
+  unsigned char toFloat(float &value) const;
+
+  // copies the characters into a String
+  String toString(void) const;
+
+private:
+  const char *ptr;
+  unsigned int len;
+};
+
+#endif  // __cplusplus
+#endif  // StringView_class_h
@@ -38,6 +38,18 @@ String::String(const String &value){
   *this = value;
 }
 
+#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+String::String(String &&rval){
+  init();
+  move(rval);
+}
+
+String::String(StringSumHelper &&rval){
+  init();
+  move(rval);
+}
+#endif
+
 String::String(char c){
   init();
   char buf[2];
@@ -94,12 +106,120 @@ String::String(double value, unsigned char decimalPlaces) {
 }
 
 String::~String(){
-    if(buffer) {
-        free(buffer);
+    if(buffer && buffer != sso) {
+        releaseBuffer(buffer, capacity + 1);
     }
     init();
 }
 
+/*********************************************/
+/*  Allocators                               */
+/*********************************************/
+
+static const StringAllocator *allocator = &StringMalloc;
+static unsigned long allocCalls, heapCalls, liveBytes;  // atomic, Strings may be used by more than one thread
+
+static void *mallocAllocate(size_t size){
+  __atomic_fetch_add(&heapCalls, 1, __ATOMIC_RELAXED);
+  return malloc(size);
+}
+
+static void *mallocReallocate(void *ptr, size_t oldsize, size_t size){
+  __atomic_fetch_add(&heapCalls, 1, __ATOMIC_RELAXED);
+  return realloc(ptr, size);
+}
+
+static void mallocRelease(void *ptr, size_t size){
+  free(ptr);
+}
+
+const StringAllocator StringMalloc = { mallocAllocate, mallocReallocate, mallocRelease };
+
+#define POOL_CLASSES 6   // 32, 64, ... 1024 bytes; the inline buffer takes anything smaller
+
+struct PoolBlock {
+  PoolBlock *next;
+};
+
+static thread_local PoolBlock *poolFree[POOL_CLASSES];
+
+// size class of a block, POOL_CLASSES if it's too large for the pool
+static unsigned int poolClass(size_t size){
+  unsigned int c = 0;
+  size_t classSize = 32;
+  while (classSize < size && c < POOL_CLASSES) {
+    classSize <<= 1;
+    c++;
+  }
+  return c;
+}
+
+static void *poolAllocate(size_t size){
+  unsigned int c = poolClass(size);
+  if (c < POOL_CLASSES) {
+    PoolBlock *block = poolFree[c];
+    if (block) {
+      poolFree[c] = block->next;
+      return block;
+    }
+    size = (size_t)32 << c;
+  }
+  __atomic_fetch_add(&heapCalls, 1, __ATOMIC_RELAXED);
+  return malloc(size);
+}
+
+static void poolRelease(void *ptr, size_t size){
+  unsigned int c = poolClass(size);
+  if (c < POOL_CLASSES) {
+    PoolBlock *block = (PoolBlock *)ptr;
+    block->next = poolFree[c];
+    poolFree[c] = block;
+  } else {
+    free(ptr);
+  }
+}
+
+static void *poolReallocate(void *ptr, size_t oldsize, size_t size){
+  unsigned int c = poolClass(size);
+  if (c == poolClass(oldsize)) {
+    if (c < POOL_CLASSES) return ptr;  // still fits its block
+    __atomic_fetch_add(&heapCalls, 1, __ATOMIC_RELAXED);
+    return realloc(ptr, size);
+  }
+  void *newptr = poolAllocate(size);
+  if (!newptr) return NULL;
+  memcpy(newptr, ptr, oldsize < size ? oldsize : size);
+  poolRelease(ptr, oldsize);
+  return newptr;
+}
+
+const StringAllocator StringPool = { poolAllocate, poolReallocate, poolRelease };
+
+unsigned char setStringAllocator(const StringAllocator *newallocator){
+  if (__atomic_load_n(&liveBytes, __ATOMIC_RELAXED) != 0) return 0;
+  allocator = newallocator ? newallocator : &StringMalloc;
+  return 1;
+}
+
+void getStringAllocStats(StringAllocStats &stats){
+  stats.calls = __atomic_load_n(&allocCalls, __ATOMIC_RELAXED);
+  stats.heapCalls = __atomic_load_n(&heapCalls, __ATOMIC_RELAXED);
+  stats.liveBytes = __atomic_load_n(&liveBytes, __ATOMIC_RELAXED);
+}
+
+void *String::allocateBuffer(size_t size, void *old, size_t oldsize){
+  if (!old) oldsize = 0;
+  void *ptr = old ? allocator->reallocate(old, oldsize, size) : allocator->allocate(size);
+  __atomic_fetch_add(&allocCalls, 1, __ATOMIC_RELAXED);
+  if (ptr) __atomic_fetch_add(&liveBytes, size - oldsize, __ATOMIC_RELAXED);
+  return ptr;
+}
+
+void String::releaseBuffer(void *ptr, size_t size){
+  allocator->release(ptr, size);
+  __atomic_fetch_sub(&liveBytes, size, __ATOMIC_RELAXED);
+}
+
 /*********************************************/
 /*  Memory Management                        */
 /*********************************************/
@@ -111,7 +231,7 @@ inline void String::init(void){
 }
 
 void String::invalidate(void){
-  if (buffer) free(buffer);
+  if (buffer && buffer != sso) releaseBuffer(buffer, capacity + 1);
   buffer = NULL;
   capacity = len = 0;
 }
@@ -126,7 +246,21 @@ unsigned char String::reserve(unsigned int size){
 }
 
 unsigned char String::changeBuffer(unsigned int maxStrLen){
-  char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
+  if (!buffer && maxStrLen < STRING_SSO_SIZE) {
+    buffer = sso;
+    capacity = STRING_SSO_SIZE - 1;
+    return 1;
+  }
+  if (buffer == sso) {
+    if (maxStrLen < STRING_SSO_SIZE) return 1;
+    char *newbuffer = (char *)allocateBuffer(maxStrLen + 1, NULL, 0);
+    if (!newbuffer) return 0;
+    memcpy(newbuffer, sso, len + 1);
+    buffer = newbuffer;
+    capacity = maxStrLen;
+    return 1;
+  }
+  char *newbuffer = (char *)allocateBuffer(maxStrLen + 1, buffer, capacity + 1);
   if (newbuffer) {
     buffer = newbuffer;
     capacity = maxStrLen;
@@ -135,6 +269,18 @@ unsigned char String::changeBuffer(unsigned int maxStrLen){
   return 0;
 }
 
+void String::shrink_to_fit(void){
+  if (!buffer || buffer == sso || capacity == len) return;
+  if (len < STRING_SSO_SIZE) {
+    memcpy(sso, buffer, len + 1);
+    releaseBuffer(buffer, capacity + 1);
+    buffer = sso;
+    capacity = STRING_SSO_SIZE - 1;
+    return;
+  }
+  changeBuffer(len);
+}
+
 /*********************************************/
 /*  Copy and Move                            */
 /*********************************************/
@@ -158,6 +304,34 @@ String & String::operator = (const String &rhs){
   return *this;
 }
 
+#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+void String::move(String &rhs){
+  if (this == &rhs) return;
+  if (buffer && buffer != sso) releaseBuffer(buffer, capacity + 1);
+  if (rhs.buffer == rhs.sso) {  // short strings aren't on the heap, copy them
+    buffer = sso;
+    memcpy(sso, rhs.sso, rhs.len + 1);
+  } else {
+    buffer = rhs.buffer;
+  }
+  capacity = rhs.capacity;
+  len = rhs.len;
+  rhs.buffer = NULL;
+  rhs.capacity = 0;
+  rhs.len = 0;
+}
+
+String & String::operator = (String &&rval){
+  move(rval);
+  return *this;
+}
+
+String & String::operator = (StringSumHelper &&rval){
+  move(rval);
+  return *this;
+}
+#endif
+
 String & String::operator = (const char *cstr){
   if (cstr) copy(cstr, strlen(cstr));
   else invalidate();
@@ -177,9 +351,20 @@ unsigned char String::concat(const char *cstr, unsigned int length){
   unsigned int newlen = len + length;
   if (!cstr) return 0;
   if (length == 0) return 1;
-  if (!reserve(newlen)) return 0;
-  strcpy(buffer + len, cstr);
-  len = strlen(buffer);
+  if (!buffer || newlen > capacity) {
+    // grow by half so that appending piece by piece reallocates O(log n) times,
+    // cstr may point into our own buffer (s += s) and has to follow it
+    unsigned char inside = buffer && cstr >= buffer && cstr <= buffer + capacity;
+    unsigned int offset = inside ? cstr - buffer : 0;
+    unsigned int grown = capacity + (capacity >> 1);
+    if (grown < newlen || !reserve(grown)) {
+      if (!reserve(newlen)) return 0;
+    }
+    if (inside) cstr = buffer + offset;
+  }
+  memcpy(buffer + len, cstr, length);
+  len = newlen;
+  buffer[len] = 0;
   return 1;
 }
 
@@ -444,7 +629,7 @@ int String::indexOf(char c) const
 int String::indexOf( char ch, unsigned int fromIndex ) const
 {
   if (fromIndex >= len) return -1;
-  const char* temp = strchr(buffer + fromIndex, ch);
+  const char* temp = (const char *) memchr(buffer + fromIndex, ch, len - fromIndex);
   if (temp == NULL) return -1;
   return temp - buffer;
 }
@@ -456,8 +641,13 @@ int String::indexOf(const String &s2) const
 
 int String::indexOf(const String &s2, unsigned int fromIndex) const
 {
-  if (fromIndex >= len) return -1;
+  if (fromIndex >= len || !s2.buffer) return -1;
+#ifdef __ARM_NEON
+  const char *found = (const char *) memfind(buffer + fromIndex, len - fromIndex, s2.buffer, s2.len);
+#else
+  // glibc's strstr() is vectorized on x86 already
   const char *found = strstr(buffer + fromIndex, s2.buffer);
+#endif
   if (found == NULL) return -1;
   return found - buffer;
 }
@@ -470,10 +660,7 @@ int String::lastIndexOf( char theChar ) const
 int String::lastIndexOf(char ch, unsigned int fromIndex) const
 {
   if (fromIndex >= len) return -1;
-  char tempchar = buffer[fromIndex + 1];
-  buffer[fromIndex + 1] = '\0';
-  char* temp = strrchr( buffer, ch );
-  buffer[fromIndex + 1] = tempchar;
+  const char* temp = (const char *) memrchr(buffer, ch, fromIndex + 1);
   if (temp == NULL) return -1;
   return temp - buffer;
 }
@@ -608,7 +795,7 @@ void String::trim(void)
   char *end = buffer + len - 1;
   while (isspace(*end) && end >= begin) end--;
   len = end + 1 - begin;
-  if (begin > buffer) memcpy(buffer, begin, len);
+  if (begin > buffer) memmove(buffer, begin, len);
   buffer[len] = 0;
 }
 
@@ -624,6 +811,6 @@ long String::toInt(void) const
 
 float String::toFloat(void) const
 {
-  if (buffer) return float(atof(buffer));
+  if (buffer) return float(strntod(buffer, len, NULL));
   return 0;
 }
@@ -28,6 +28,37 @@
 #include <ctype.h>
 #include <stdlib_noniso.h>
 
+// Strings shorter than this live inside the String object instead of on the heap.
+#ifndef STRING_SSO_SIZE
+#define STRING_SSO_SIZE 16
+#endif
+
+// Where the heap memory of Strings comes from. The String passes the size of
+// the block to reallocate() and release(), so an allocator needs no headers.
+struct StringAllocator {
+  void *(*allocate)(size_t size);
+  void *(*reallocate)(void *ptr, size_t oldsize, size_t size);
+  void (*release)(void *ptr, size_t size);
+};
+
+// malloc(), realloc() and free(), the default
+extern const StringAllocator StringMalloc;
+// per-thread free lists for blocks of 32 to 1024 bytes: released blocks are
+// kept for the next String of the same size class instead of being freed,
+// so a program in steady state doesn't call malloc() any more
+extern const StringAllocator StringPool;
+
+// Switches the allocator. Only possible while no String has memory on the
+// heap, i.e. at the start of setup(); returns 0 otherwise.
+unsigned char setStringAllocator(const StringAllocator *allocator);
+
+struct StringAllocStats {
+  unsigned long calls;       // allocate/reallocate calls by Strings
+  unsigned long heapCalls;   // of those, how many went to malloc()/realloc()
+  unsigned long liveBytes;   // bytes Strings hold on the heap right now
+};
+void getStringAllocStats(StringAllocStats &stats);
+
 // An inherited class for holding the result of a concatenation.  These
 // result objects are assumed to be writable by subsequent concatenations.
 class StringSumHelper;
@@ -49,6 +80,10 @@ public:
   // be false).
   String(const char *cstr = "");
   String(const String &str);
+  #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+  String(String &&rval);
+  String(StringSumHelper &&rval);
+  #endif
   
   explicit String(char c);
   explicit String(unsigned char, unsigned char base = 10);
@@ -61,6 +96,8 @@ public:
   ~String(void);
 
   unsigned char reserve(unsigned int size);
+  // gives memory that appending reserved in advance back
+  void shrink_to_fit(void);
   inline unsigned int length(void) const {
 	if(buffer) {
 		return len;
@@ -74,6 +111,10 @@ public:
   // marked as invalid ("if (s)" will be false).
   String & operator = (const String &rhs);
   String & operator = (const char *cstr);
+  #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+  String & operator = (String &&rval);
+  String & operator = (StringSumHelper &&rval);
+  #endif
   
   // concatenate (works w/ built-in types)
 
@@ -90,6 +131,7 @@ public:
   unsigned char concat(unsigned long num);
   unsigned char concat(float num);
   unsigned char concat(double num);
+  unsigned char concat(const char *cstr, unsigned int length);
   
   // if there's not enough memory for the concatenated value, the string
   // will be left unchanged (but this isn't signalled in any way)
@@ -175,17 +217,22 @@ public:
   float toFloat(void) const;
 
 protected:
-  char *buffer;          // the actual char array
+  char *buffer;          // the actual char array, sso or on the heap
   unsigned int capacity;  // the array length minus one (for the '\0')
   unsigned int len;       // the String length (not counting the '\0')
+  char sso[STRING_SSO_SIZE]; // inline storage for short strings
 protected:
   void init(void);
   void invalidate(void);
   unsigned char changeBuffer(unsigned int maxStrLen);
-  unsigned char concat(const char *cstr, unsigned int length);
+  static void *allocateBuffer(size_t size, void *old, size_t oldsize);
+  static void releaseBuffer(void *ptr, size_t size);
 
   // copy and move
   String & copy(const char *cstr, unsigned int length);
+  #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+  void move(String &rhs);
+  #endif
 };
 
 class StringSumHelper : public String
@@ -201,7 +248,25 @@ public:
   StringSumHelper(unsigned long num) : String(num) {}
   StringSumHelper(float num) 		 : String(num) {}
   StringSumHelper(double num) 		 : String(num) {}
+  #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+  StringSumHelper(String &&s) 		 : String(static_cast<String &&>(s)) {}
+  #endif
 };
 
+#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+// Concatenating onto a temporary hands the temporary on as an rvalue, so
+// the String finally assigned or constructed from it takes its buffer.
+inline StringSumHelper && operator + (StringSumHelper &&lhs, const String &rhs)  {return static_cast<StringSumHelper &&>(lhs + rhs);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, const char *cstr)   {return static_cast<StringSumHelper &&>(lhs + cstr);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, char c)             {return static_cast<StringSumHelper &&>(lhs + c);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, unsigned char num)  {return static_cast<StringSumHelper &&>(lhs + num);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, int num)            {return static_cast<StringSumHelper &&>(lhs + num);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, unsigned int num)   {return static_cast<StringSumHelper &&>(lhs + num);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, long num)           {return static_cast<StringSumHelper &&>(lhs + num);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, unsigned long num)  {return static_cast<StringSumHelper &&>(lhs + num);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, float num)          {return static_cast<StringSumHelper &&>(lhs + num);}
+inline StringSumHelper && operator + (StringSumHelper &&lhs, double num)         {return static_cast<StringSumHelper &&>(lhs + num);}
+#endif
+
 #endif  // __cplusplus
 #endif  // String_class_h
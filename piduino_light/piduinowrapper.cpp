@@ -21,12 +21,136 @@
 #include "Arduino.h"
 #include "HardwareSerial.h"
 #include <stdio.h>
+#include <poll.h>
 
 HardwareSerial Serial;
 HardwareSerial Serial1;
 
+struct ReactorTimer {
+	unsigned long interval;
+	unsigned long due;
+	voidFuncPtr callback;
+};
+
+struct ReactorFd {
+	int fd;
+	voidFuncPtr callback;
+};
+
+static bool reactor = false;
+static ReactorTimer timers[REACTOR_MAX_TIMERS];
+static int numtimers = 0;
+static ReactorFd fds[REACTOR_MAX_FDS];
+static int numfds = 0;
+
+uint8_t reactorMode(uint8_t on)
+{
+	if (on && (Serial1.hasReaderThread() || Serial.hasReaderThread())) {
+		fprintf(stderr, "Pi: Reactor mode can't be used while a reader thread reads the serial port\n");
+		return 0;
+	}
+	reactor = on;
+	return 1;
+}
+
+uint8_t reactorActive()
+{
+	return reactor;
+}
+
+int reactorAddTimer(unsigned long interval, voidFuncPtr callback)
+{
+	if (numtimers == REACTOR_MAX_TIMERS) return -1;
+	timers[numtimers].interval = interval;
+	timers[numtimers].due = millis() + interval;
+	timers[numtimers].callback = callback;
+	return numtimers++;
+}
+
+int reactorAddFd(int fd, voidFuncPtr callback)
+{
+	if (numfds == REACTOR_MAX_FDS) return -1;
+	fds[numfds].fd = fd;
+	fds[numfds].callback = callback;
+	return numfds++;
+}
+
+// Input loop() leaves unread must not wake it again, or an ignored console line spins loop().
+// A port wakes loop() only when it has more buffered than when loop() last returned.
+static HardwareSerial *ports[2] = { &Serial1, &Serial };
+static int seen[2];
+
+static void watchAfter()
+{
+	for (int i = 0; i < 2; i++) seen[i] = ports[i]->buffered();
+}
+
+// Returns true if loop() is due for input on this port, adds its descriptor to the poll set otherwise.
+static bool watchPoll(int i, struct pollfd *pfd, int &npfd)
+{
+	int fd = ports[i]->getFd();
+	if (fd == -1) return false;
+	int buffered = ports[i]->receive(); // the kernel queue is empty now, so POLLIN means new input
+	if (buffered < seen[i]) seen[i] = buffered; // read by a callback
+	if (buffered > seen[i]) return true;
+	if (buffered == SERIAL_RX_BUFFER_SIZE) return false; // nothing more fits before the sketch reads
+	pfd[npfd].fd = fd;
+	pfd[npfd++].events = POLLIN;
+	return false;
+}
+
+// Sleeps until something is ready, runs the callbacks and returns true if loop() is due.
+static bool reactorWait()
+{
+	struct pollfd pfd[REACTOR_MAX_FDS + 2];
+	int npfd = 0;
+	int timeout = -1;
+	bool runloop = false;
+
+	for (int i = 0; i < 2; i++) {
+		if (watchPoll(i, pfd, npfd)) return true;
+	}
+	int first = npfd;
+	for (int i = 0; i < numfds; i++) {
+		pfd[npfd].fd = fds[i].fd;
+		pfd[npfd++].events = POLLIN;
+	}
+	unsigned long now = millis();
+	for (int i = 0; i < numtimers; i++) {
+		long left = (long)(timers[i].due - now);
+		if (left < 0) left = 0;
+		if (timeout < 0 || left < timeout) timeout = left;
+	}
+
+	if (poll(pfd, npfd, timeout) < 0) {
+		if (errno != EINTR) fprintf(stderr, "Pi: Reactor poll failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	now = millis();
+	for (int i = 0; i < numtimers; i++) {
+		if ((long)(timers[i].due - now) > 0) continue;
+		timers[i].due += timers[i].interval;
+		if ((long)(timers[i].due - now) <= 0) timers[i].due = now + timers[i].interval; // don't try to catch up
+		if (timers[i].callback) timers[i].callback();
+		else runloop = true;
+	}
+	for (int i = 0; i < first; i++) {
+		if (pfd[i].revents) runloop = true;
+	}
+	for (int i = first; i < npfd; i++) {
+		if (!pfd[i].revents) continue;
+		if (fds[i - first].callback) fds[i - first].callback();
+		else runloop = true;
+	}
+	return runloop;
+}
+
 int main(int argv, char **args)
 {
+	if (getenv("PIDUINO_STRING_POOL")) {
+		setStringAllocator(&StringPool); // before the first String gets heap memory
+	}
 	String device="/dev/serial0";
 	if (argv>2) {
 		fprintf(stderr,"Usage: %s [<device>]\n",args[0]);
@@ -51,7 +175,13 @@ int main(int argv, char **args)
 	Serial1.end(); // close it again so MOVI API can open it.
 	setup();
 	while (1) { 
+		if (!reactor) {
+			loop();
+			continue;
+		}
+		if (!reactorWait()) continue;
 		loop();
+		watchAfter();
 	}
 	return 0;
 } 
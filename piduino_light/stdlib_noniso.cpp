@@ -19,7 +19,14 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <math.h>
+#include <stdio.h>
+#include <ctype.h>
 #include "stdlib_noniso.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 void reverse(char* begin, char* end) {
     char *is = begin;
@@ -33,11 +40,113 @@ void reverse(char* begin, char* end) {
     }
 }
 
+// Compares the needle's first and last byte against 16 candidate positions at
+// once and only calls memcmp() where both match.
+void *memfind(const void *haystack, size_t haystacklen, const void *needle, size_t needlelen) {
+    const char *h = (const char *) haystack;
+    const char *n = (const char *) needle;
+    if (needlelen == 0) return (void *) h;
+    if (needlelen > haystacklen) return NULL;
+    if (needlelen == 1) return (void *) memchr(h, n[0], haystacklen);
+#if !defined(__SSE2__) && !defined(__ARM_NEON) && defined(_GNU_SOURCE)
+    return memmem(haystack, haystacklen, needle, needlelen); // without vectors the C library's is as good
+#else
+    size_t last = needlelen - 1;
+    size_t count = haystacklen - last; // candidate positions
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i first16 = _mm_set1_epi8(n[0]);
+    const __m128i last16 = _mm_set1_epi8(n[last]);
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_cmpeq_epi8(first16, _mm_loadu_si128((const __m128i *) (h + i)));
+        __m128i b = _mm_cmpeq_epi8(last16, _mm_loadu_si128((const __m128i *) (h + i + last)));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(h + pos + 1, n + 1, last - 1) == 0) return (void *) (h + pos);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t first16 = vdupq_n_u8(n[0]);
+    const uint8x16_t last16 = vdupq_n_u8(n[last]);
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t a = vceqq_u8(first16, vld1q_u8((const uint8_t *) (h + i)));
+        uint8x16_t b = vceqq_u8(last16, vld1q_u8((const uint8_t *) (h + i + last)));
+        // narrow the 16 byte results to 4 bits each, NEON has no movemask
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vandq_u8(a, b)), 4)), 0);
+        while (mask) {
+            size_t pos = i + (__builtin_ctzll(mask) >> 2);
+            if (memcmp(h + pos + 1, n + 1, last - 1) == 0) return (void *) (h + pos);
+            mask &= ~(0xfULL << ((pos - i) << 2));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        if (h[i] == n[0] && h[i + last] == n[last] && memcmp(h + i + 1, n + 1, last - 1) == 0) return (void *) (h + i);
+    }
+    return NULL;
+#endif
+}
+
+#ifndef _GNU_SOURCE
+void *memrchr(const void *s, int c, size_t n) {
+    const unsigned char *p = (const unsigned char *) s + n;
+    while (p > (const unsigned char *) s) {
+        if (*--p == (unsigned char) c) return (void *) p;
+    }
+    return NULL;
+}
+#endif
+
+// "00" to "99", so decimal conversions need one division per two digits
+static const char digitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+char* utoa10(unsigned long value, char* end) {
+    while (value >= 100) {
+        const unsigned long tmp = value / 100;
+        const char* pair = &digitPairs[(value - tmp * 100) * 2];
+        *--end = pair[1];
+        *--end = pair[0];
+        value = tmp;
+    }
+    if (value >= 10) {
+        *--end = digitPairs[value * 2 + 1];
+        *--end = digitPairs[value * 2];
+    } else {
+        *--end = (char)('0' + value);
+    }
+    return end;
+}
+
+// Base 10 writes from the end of a scratch buffer, so nothing needs reverse()
+static char* decimal(unsigned long magnitude, bool negative, char* result) {
+    char buf[3 * sizeof(long) + 1];
+    char* end = buf + sizeof(buf);
+    char* begin = utoa10(magnitude, end);
+    char* out = result;
+    if (negative) *out++ = '-';
+    memcpy(out, begin, end - begin);
+    out[end - begin] = 0;
+    return result;
+}
+
 char* ltoa(long value, char* result, int base) {
     if(base < 2 || base > 16) {
         *result = 0;
         return result;
     }
+    if(base == 10) return decimal(value < 0 ? 0UL - (unsigned long) value : (unsigned long) value, value < 0, result);
 
     char* out = result;
     long quotient = abs(value);
@@ -63,6 +172,7 @@ char* ultoa(unsigned long value, char* result, int base) {
         *result = 0;
         return result;
     }
+    if(base == 10) return decimal(value, false, result);
 
     char* out = result;
     unsigned long quotient = value;
@@ -79,9 +189,89 @@ char* ultoa(unsigned long value, char* result, int base) {
     return result;
 }
 
-char * dtostrf(double number, signed char width, unsigned char prec, char *s) {
-    bool negative = false;
+// All exactly representable in a double
+static const double powersOf10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#ifndef FP_FAST_FMA
+// a * b - p exactly for p = a * b, by Dekker's split into 26 bit halves;
+// a software fma() would cost more than the whole conversion
+static double productError(double a, double b, double p) {
+    const double split = 134217729.0; // 2^27 + 1
+    double t = split * a;
+    const double ahi = t - (t - a), alo = a - ahi;
+    t = split * b;
+    const double bhi = t - (t - b), blo = b - bhi;
+    return ((ahi * bhi - p) + ahi * blo + alo * bhi) + alo * blo;
+}
+#endif
+
+// Writes |number| with prec decimals backwards so it ends just before end
+// (24 bytes are enough) and returns where it starts, NULL if it's too big.
+//
+// The exact product number * 10^prec is p + err: 10^prec is exact and
+// productError() gives the rounding error of the multiplication. That rounds
+// the number as written in binary instead of a rounded product, so 1.005
+// (really 1.00499999999999989...) prints as "1.00" like printf() does.
+// Exact ties round away from zero, as print(2.5, 0) always did. Below 2^53
+// |err| is at most 0.5 and the integer part fits 32 bits; anything bigger
+// the C library does, correctly but much slower.
+static char* fixedDigits(double number, unsigned char prec, char* end) {
+    if (prec > 9 || !(number < 4294967295.0)) return NULL;
+    const double scale = powersOf10[prec];
+    const double p = number * scale;
+    if (!(p < 9007199254740992.0)) return NULL;
+#ifdef FP_FAST_FMA
+    const double err = fma(number, scale, -p);
+#else
+    const double err = productError(number, scale, p);
+#endif
+    uint64_t scaled = (uint64_t) p;
+    const double frac = p - (double) scaled; // exact
+    // without branches, the digits of real data are unpredictable
+    scaled += (frac > 0.5) | ((frac == 0.5) & (err >= 0.0)) | ((frac == 0.0) & (err >= 0.5));
+
+    // No 64 bit division: scaled is at least the integer part times 10^prec
+    // and at most one unit more, when rounding carried into it
+    const unsigned long unit = (unsigned long) scale;
+    unsigned long intPart = (unsigned long) number;
+    unsigned long fracPart = (unsigned long) (scaled - (uint64_t) intPart * unit);
+    if (fracPart >= unit) {
+        intPart++;
+        fracPart -= unit;
+    }
+
+    if (prec > 0) {
+        // always prec digits, leading zeros included
+        for (unsigned char i = prec; i >= 2; i -= 2) {
+            const unsigned long tmp = fracPart / 100;
+            const char* pair = &digitPairs[(fracPart - tmp * 100) * 2];
+            *--end = pair[1];
+            *--end = pair[0];
+            fracPart = tmp;
+        }
+        if (prec & 1) *--end = (char)('0' + fracPart);
+        *--end = '.';
+    }
+    return utoa10(intPart, end);
+}
 
+int fixedtoa(double number, unsigned char prec, char* s) {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* begin = fixedDigits(fabs(number), prec, end);
+    if (begin == NULL) return sprintf(s, "%.*f", prec, number);
+    char* out = s;
+    if (number < 0.0) *out++ = '-';
+    memcpy(out, begin, end - begin);
+    out += end - begin;
+    *out = 0;
+    return (int)(out - s);
+}
+
+char * dtostrf(double number, signed char width, unsigned char prec, char *s) {
     if (isnan(number)) {
         strcpy(s, "nan");
         return s;
@@ -91,65 +281,100 @@ char * dtostrf(double number, signed char width, unsigned char prec, char *s) {
         return s;
     }
 
-    char* out = s;
-
-    int fillme = width; // how many cells to fill for the integer part
-    if (prec > 0) {
-        fillme -= (prec+1);
-    }
-
-    // Handle negative numbers
-    if (number < 0.0) {
-        negative = true;
-        fillme--;
-        number = -number;
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* begin = fixedDigits(fabs(number), prec, end);
+    if (begin == NULL) {
+        sprintf(s, "%*.*f", width > 0 ? width : 0, prec, number);
+        return s;
     }
+    if (number < 0.0) *--begin = '-';
 
-    // Round correctly so that print(1.999, 2) prints as "2.00"
-    // I optimized out most of the divisions
-    double rounding = 2.0;
-    for (uint8_t i = 0; i < prec; ++i)
-        rounding *= 10.0;
-    rounding = 1.0 / rounding;
+    // Pad unused cells with spaces in front
+    char* out = s;
+    int fillme = width - (int)(end - begin);
+    while (fillme-- > 0) *out++ = ' ';
+    memcpy(out, begin, end - begin);
+    out[end - begin] = 0;
+    return s;
+}
 
-    number += rounding;
+// Up to 19 digits are collected into an integer. If it has at most 53 bits
+// and the power of ten is exact in a double (10^22 at most) one multiply or
+// divide rounds correctly (Clinger's fast path); the rest, and "inf", "nan"
+// or hex, go to strtod().
+double strntod(const char* s, size_t len, size_t* used) {
+    size_t i = 0;
+    while (i < len && isspace((unsigned char) s[i])) i++;
+    const size_t start = i;
 
-    // Figure out how big our number really is
-    double tenpow = 1.0;
-    int digitcount = 1;
-    while (number >= 10.0 * tenpow) {
-        tenpow *= 10.0;
-        digitcount++;
+    bool negative = false;
+    if (i < len && (s[i] == '-' || s[i] == '+')) negative = s[i++] == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    bool exact = true;
+    for (; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (s[i] - '0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+            if (s[i] != '0') exact = false;
+        }
     }
-
-    number /= tenpow;
-    fillme -= digitcount;
-
-    // Pad unused cells with spaces
-    while (fillme-- > 0) {
-        *out++ = ' ';
+    if (i < len && s[i] == '.') {
+        for (i++; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (s[i] - '0');
+                if (mantissa) digits++;
+                exponent--;
+            } else if (s[i] != '0') {
+                exact = false;
+            }
+        }
     }
-
-    // Handle negative sign
-    if (negative) *out++ = '-';
-
-    // Print the digits, and if necessary, the decimal point
-    digitcount += prec;
-    int8_t digit = 0;
-    while (digitcount-- > 0) {
-        digit = (int8_t)number;
-        if (digit > 9) digit = 9; // insurance
-        *out++ = (char)('0' | digit);
-        if ((digitcount == prec) && (prec > 0)) {
-            *out++ = '.';
+    if (any && i < len && (s[i] == 'e' || s[i] == 'E')) {
+        size_t j = i + 1;
+        bool negativeExp = false;
+        if (j < len && (s[j] == '-' || s[j] == '+')) negativeExp = s[j++] == '-';
+        if (j < len && s[j] >= '0' && s[j] <= '9') {
+            int e = 0;
+            for (; j < len && s[j] >= '0' && s[j] <= '9'; j++) {
+                if (e < 100000) e = e * 10 + (s[j] - '0');
+            }
+            exponent += negativeExp ? -e : e;
+            i = j;
         }
-        number -= digit;
-        number *= 10.0;
     }
 
-    // make sure the string is terminated
-    *out = 0;
-    return s;
+    const bool hex = any && i < len && (s[i] == 'x' || s[i] == 'X');
+    if (any && !hex && exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double value = (double) mantissa;
+        if (exponent < 0) value /= powersOf10[-exponent];
+        else value *= powersOf10[exponent];
+        if (used) *used = i;
+        return negative ? -value : value;
+    }
+
+    char small[64];
+    const size_t n = len - start;
+    char* buf = n < sizeof(small) ? small : (char*) malloc(n + 1);
+    if (buf == NULL) {
+        if (used) *used = 0;
+        return 0.0;
+    }
+    memcpy(buf, s + start, n);
+    buf[n] = 0;
+    char* end;
+    double value = strtod(buf, &end);
+    if (used) *used = end == buf ? 0 : start + (end - buf);
+    if (buf != small) free(buf);
+    return value;
 }
 
 char* utoa(unsigned value, char* result, int base) {
@@ -157,6 +382,7 @@ char* utoa(unsigned value, char* result, int base) {
         *result = 0;
         return result;
     }
+    if(base == 10) return decimal(value, false, result);
 
     char* out = result;
     unsigned quotient = value;
@@ -178,6 +404,7 @@ char* itoa(int value, char* result, int base) {
         *result = 0;
         return result;
     }
+    if(base == 10) return decimal(value < 0 ? 0U - (unsigned) value : (unsigned) value, value < 0, result);
 
     char* out = result;
     int quotient = abs(value);
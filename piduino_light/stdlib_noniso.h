@@ -36,8 +36,28 @@ char* ultoa (unsigned long val, char *s, int radix);
  
 char* dtostrf (double val, signed char width, unsigned char prec, char *s);
 
+// Writes the decimal digits of val so they end just before end (no NUL),
+// returns the first one
+char* utoa10 (unsigned long val, char *end);
+
+// Writes val with prec decimals, correctly rounded and NUL-terminated,
+// returns the length
+int fixedtoa (double val, unsigned char prec, char *s);
+
+// Parses a decimal number from len characters like strtod(), which they
+// don't need to be NUL-terminated for; *used gets how many were taken, 0
+// if there is no number
+double strntod (const char *s, size_t len, size_t *used);
+
 void reverse(char* begin, char* end);
 
+// Finds needle in haystack like memmem(), with SSE2 or NEON for the short strings of speech results
+void *memfind(const void *haystack, size_t haystacklen, const void *needle, size_t needlelen);
+
+#ifndef _GNU_SOURCE
+void *memrchr(const void *s, int c, size_t n);
+#endif
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -6,105 +6,217 @@
   Adapted for higher robustness 2018 by Gerald Friedland at Audeme.com. 
   Alternative, more powerful implementations of GPIO are discussed a  
   https://elinux.org/RPi_GPIO_Code_Samples
+
+  Lines are kept open once configured. If the GPIO character device
+  (/dev/gpiochip0 or $PIDUINO_GPIOCHIP) can be used, all configured lines are
+  held in one line request and read or written with a single ioctl. A
+  direction change is applied to that request in place, with the values of
+  the outputs in the new configuration, so the other lines keep their state.
+  Lines the character device refuses, or all lines if it cannot be opened,
+  use the sysfs value files (/sys/class/gpio or $PIDUINO_SYSFS_GPIO), which
+  are opened once and accessed with pread()/pwrite().
 */
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <linux/gpio.h>
 #include "Arduino.h"
 #include "sysfsio.h"
 
 #define SYSFS_BUFFER_MAX 3
-#define GPIO_VALUE_MAX 30
-#define GPIO_DIRECTION_MAX 35
+#define GPIO_PATH_MAX 256
 #define GPIO_TRIALS 5
 
-int GPIOExport(int pin)
+#ifdef GPIO_V2_GET_LINE_IOCTL
+#define GPIO_CHARDEV 1
+#endif
+
+struct GPIOLine {
+	bool used;      // exported or requested
+	bool sysfs;     // exported through sysfs
+	int mode;       // INPUT, OUTPUT, INPUT_PULLUP or INPUT_PULLDOWN
+	int value;      // last value written
+	int index;      // position in the line request, -1 if not requested
+	int valuefd;    // cached sysfs value file, -1 if not open
+};
+
+static bool initialized = false;
+static GPIOLine lines[GPIO_MAX_PINS];
+static const char *sysfsroot = "/sys/class/gpio";
+static int chipfd = -1;     // GPIO character device, -1 if sysfs is used
+static int requestfd = -1;  // line request holding the lines not on sysfs
+
+static void GPIOInit()
 {
-	char buffer[SYSFS_BUFFER_MAX];
-	ssize_t bytes_written;
-	int fd;
-	int trialsleft=GPIO_TRIALS;
+	if (initialized) return;
+	initialized = true;
+	for (int i = 0; i < GPIO_MAX_PINS; i++) {
+		lines[i].used = false;
+		lines[i].sysfs = false;
+		lines[i].mode = INPUT;
+		lines[i].value = LOW;
+		lines[i].index = -1;
+		lines[i].valuefd = -1;
+	}
+	const char *e = getenv("PIDUINO_SYSFS_GPIO");
+	if (e) sysfsroot = e;
+#ifdef GPIO_CHARDEV
+	const char *chip = getenv("PIDUINO_GPIOCHIP");
+	if (!chip) chip = "/dev/gpiochip0";
+	chipfd = open(chip, O_RDWR | O_CLOEXEC);
+#endif
+}
 
-	while (trialsleft>0) { 
-		fd = open("/sys/class/gpio/export", O_WRONLY);
-		if (-1 == fd) {
-			trialsleft--;
-			if (trialsleft==0) {
-				fprintf(stderr, "Pi: Failed to open GPIO %d for writing!\n", pin);
-				return(-1);
-			}
-			else delay(100);
-		} else {
-			trialsleft=0;
+static bool validPin(int pin)
+{
+	if (pin >= 0 && pin < GPIO_MAX_PINS) return true;
+	fprintf(stderr, "Pi: GPIO %d out of range!\n", pin);
+	return false;
+}
+
+// Opens a sysfs file, retrying while udev may still be fixing up permissions after an export.
+static int openRetry(const char *path, int flags, const char *what, int pin)
+{
+	int fd;
+	int trialsleft = GPIO_TRIALS;
+	while ((fd = open(path, flags)) == -1) {
+		trialsleft--;
+		if (trialsleft == 0) {
+			fprintf(stderr, "Pi: Failed to open GPIO %d %s!\n", pin, what);
+			return(-1);
 		}
+		delay(100);
 	}
+	return fd;
+}
 
-	bytes_written = snprintf(buffer, SYSFS_BUFFER_MAX, "%d", pin);
-	write(fd, buffer, bytes_written);
+static int writeSysfs(const char *file, int pin, const char *what)
+{
+	char path[GPIO_PATH_MAX];
+	char buffer[SYSFS_BUFFER_MAX];
+	snprintf(path, GPIO_PATH_MAX, "%s/%s", sysfsroot, file);
+	int fd = openRetry(path, O_WRONLY, what, pin);
+	if (-1 == fd) return(-1);
+	ssize_t bytes_written = snprintf(buffer, SYSFS_BUFFER_MAX, "%d", pin);
+	write(fd, buffer, bytes_written); // fails with EBUSY if the pin is already (un)exported
 	close(fd);
 	return(0);
 }
 
-int GPIOUnexport(int pin)
+static int valueFd(int pin)
 {
-	char buffer[SYSFS_BUFFER_MAX];
-	ssize_t bytes_written;
-	int fd;
-	int trialsleft=GPIO_TRIALS;
-	while (trialsleft>0) { 
-		fd = open("/sys/class/gpio/unexport", O_WRONLY);
-		if (-1 == fd) {
-			trialsleft--;
-			if (trialsleft==0) {
-				fprintf(stderr, "Pi: Failed to open GPIO %d to unexport!\n",pin);
-				return(-1);
-			}
-			else delay(100);
-		} else {
-			trialsleft=0;
+	if (lines[pin].valuefd != -1) return lines[pin].valuefd;
+	char path[GPIO_PATH_MAX];
+	snprintf(path, GPIO_PATH_MAX, "%s/gpio%d/value", sysfsroot, pin);
+	int fd = openRetry(path, O_RDWR, "value", pin); // read-only would make every write fail
+	lines[pin].valuefd = fd;
+	return fd;
+}
+
+static void closeValueFd(int pin)
+{
+	if (lines[pin].valuefd != -1) close(lines[pin].valuefd);
+	lines[pin].valuefd = -1;
+}
+
+#ifdef GPIO_CHARDEV
+static void addFlagsAttr(struct gpio_v2_line_config *config, __u64 flags, __u64 mask)
+{
+	if (!mask) return;
+	struct gpio_v2_line_config_attribute *a = &config->attrs[config->num_attrs++];
+	a->attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+	a->attr.flags = flags;
+	a->mask = mask;
+}
+
+// Fills in the configuration of all requested lines. Outputs keep the last value written.
+static void linesConfig(struct gpio_v2_line_config *config)
+{
+	__u64 outmask = 0, outvalues = 0, upmask = 0, downmask = 0;
+
+	memset(config, 0, sizeof(*config));
+	for (int pin = 0; pin < GPIO_MAX_PINS; pin++) {
+		if (lines[pin].index < 0) continue;
+		__u64 bit = 1ULL << lines[pin].index;
+		if (lines[pin].mode == OUTPUT) {
+			outmask |= bit;
+			if (lines[pin].value != LOW) outvalues |= bit;
+		} else if (lines[pin].mode == INPUT_PULLUP) {
+			upmask |= bit;
+		} else if (lines[pin].mode == INPUT_PULLDOWN) {
+			downmask |= bit;
 		}
 	}
-	
-	close(fd);
-	bytes_written = snprintf(buffer, SYSFS_BUFFER_MAX, "%d", pin);
-	write(fd, buffer, bytes_written);
-	close(fd);
+	config->flags = GPIO_V2_LINE_FLAG_INPUT;
+	addFlagsAttr(config, GPIO_V2_LINE_FLAG_OUTPUT, outmask);
+	addFlagsAttr(config, GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP, upmask);
+	addFlagsAttr(config, GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN, downmask);
+	if (outmask) {
+		struct gpio_v2_line_config_attribute *a = &config->attrs[config->num_attrs++];
+		a->attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		a->attr.values = outvalues;
+		a->mask = outmask;
+	}
+}
+
+// Replaces the line request by one holding all used lines that are not on sysfs.
+// Only needed when a line joins or leaves, the outputs are driven with their last value.
+static int requestLines()
+{
+	struct gpio_v2_line_request req;
+	unsigned int n = 0;
+
+	memset(&req, 0, sizeof(req));
+	strncpy(req.consumer, "piduino", sizeof(req.consumer) - 1);
+	for (int pin = 0; pin < GPIO_MAX_PINS; pin++) {
+		lines[pin].index = -1;
+		if (!lines[pin].used || lines[pin].sysfs) continue;
+		lines[pin].index = n;
+		req.offsets[n++] = pin;
+	}
+	if (requestfd != -1) close(requestfd);
+	requestfd = -1;
+	if (n == 0) return(0);
+	req.num_lines = n;
+	linesConfig(&req.config);
+	if (-1 == ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &req)) {
+		for (int pin = 0; pin < GPIO_MAX_PINS; pin++) lines[pin].index = -1;
+		return(-1);
+	}
+	requestfd = req.fd;
 	return(0);
 }
+#endif
 
-int GPIODirection(int pin, int dir)
+// Exports the line and sets its direction through sysfs.
+static int sysfsDirection(int pin, int dir)
 {
 	static const char s_directions_str[]  = "in\0out";
-	char path[GPIO_DIRECTION_MAX];
+	char path[GPIO_PATH_MAX];
 	int fd;
 	int trialsleft=GPIO_TRIALS;
 
-	snprintf(path, GPIO_DIRECTION_MAX, "/sys/class/gpio/gpio%d/direction", pin);
-
-	while (trialsleft>0) { 
-		fd = open(path, O_WRONLY);
-		if (-1 == fd) {
-			trialsleft--;
-			if (trialsleft==0) {
-				fprintf(stderr, "Pi: Failed to setup GPIO %d for writing!\n", pin);
-				return(-1);
-			}
-			else delay(100);
-		} else {
-			trialsleft=0;
-		}
+	if (!lines[pin].sysfs) {
+		lines[pin].sysfs = true;
+		if (-1 == writeSysfs("export", pin, "export")) return(-1);
 	}
+	snprintf(path, GPIO_PATH_MAX, "%s/gpio%d/direction", sysfsroot, pin);
+	fd = openRetry(path, O_WRONLY, "direction", pin);
+	if (-1 == fd) return(-1);
 	
-	trialsleft=GPIO_TRIALS;
 	while (trialsleft>0) { 
-		if (-1 == write(fd, &s_directions_str[INPUT == dir ? 0 : 3], INPUT == dir ? 2 : 3)) {
+		if (-1 == write(fd, &s_directions_str[OUTPUT != dir ? 0 : 3], OUTPUT != dir ? 2 : 3)) {
 			trialsleft--;
 			if (trialsleft==0) {
 				fprintf(stderr, "Pi: Failed to set GPIO %d direction!\n",pin);
+				close(fd);
 				return(-1);
 			}
 			else delay(100);
@@ -113,85 +225,177 @@ int GPIODirection(int pin, int dir)
 		}
 	}
 	close(fd);
+	closeValueFd(pin); // reopen with the permissions of the new direction
+	if (-1 == valueFd(pin)) return(-1);
 	return(0);
 }
 
-int GPIORead(int pin)
+#ifdef GPIO_CHARDEV
+// Requests the lines again after one joined or left. If the character device
+// refuses, the line that joined moves to sysfs; should the others be refused
+// as well, they all do.
+static int rerequestLines(int pin)
 {
-	char path[GPIO_VALUE_MAX];
-	char value_str[3];
-	int fd;
-	int trialsleft=GPIO_TRIALS;
-	snprintf(path, GPIO_VALUE_MAX, "/sys/class/gpio/gpio%d/value", pin);
-	while (trialsleft>0) { 
-		fd = open(path, O_RDONLY);
-		if (-1 == fd) {
-			trialsleft--;
-			if (trialsleft==0) {
-				fprintf(stderr, "Pi: Failed to open GPIO %d value for reading!\n",pin);
-				return(-1);
-			}
-			else delay(100);
-		} else {
-			trialsleft=0;
-		}
+	if (requestLines() == 0) return(0);
+	fprintf(stderr, "Pi: GPIO %d line request failed: %s. Falling back to sysfs.\n", pin, strerror(errno));
+	if (lines[pin].used) lines[pin].sysfs = true; // leaves the request
+	if (requestLines() == 0) {
+		if (!lines[pin].used) return(0);
+		lines[pin].sysfs = false; // not exported yet
+		return sysfsDirection(pin, lines[pin].mode);
+	}
+	fprintf(stderr, "Pi: GPIO line request failed: %s. Falling back to sysfs.\n", strerror(errno));
+	int result = 0;
+	for (int other = 0; other < GPIO_MAX_PINS; other++) {
+		if (!lines[other].used || (lines[other].sysfs && other != pin)) continue;
+		lines[other].sysfs = false; // not exported yet
+		if (-1 == sysfsDirection(other, lines[other].mode)) result = -1;
+		else if (lines[other].mode == OUTPUT) GPIOWrite(other, lines[other].value);
 	}
+	return(result);
+}
+#endif
 
-	
-	trialsleft=GPIO_TRIALS;
-	while (trialsleft>0) { 
-		if (-1 == read(fd, value_str, 3)) {
-			trialsleft--;
-			if (trialsleft==0) {
-				fprintf(stderr, "Pi: Failed to read value from GPIO %d!\n",pin);
-				return(-1);
-			}
-			else delay(100);
-		} else {
-			trialsleft=0;
+int GPIOExport(int pin)
+{
+	GPIOInit();
+	if (!validPin(pin)) return(-1);
+	lines[pin].used = true;
+#ifdef GPIO_CHARDEV
+	if (chipfd != -1 && !lines[pin].sysfs) return(0); // requested with its direction in GPIODirection()
+#endif
+	lines[pin].sysfs = true;
+	return writeSysfs("export", pin, "export");
+}
+
+int GPIOUnexport(int pin)
+{
+	GPIOInit();
+	if (!validPin(pin)) return(-1);
+	lines[pin].used = false;
+	closeValueFd(pin);
+#ifdef GPIO_CHARDEV
+	if (lines[pin].index >= 0) return rerequestLines(pin);
+	if (chipfd != -1 && !lines[pin].sysfs) return(0);
+#endif
+	lines[pin].sysfs = false;
+	return writeSysfs("unexport", pin, "unexport");
+}
+
+int GPIODirection(int pin, int dir)
+{
+	GPIOInit();
+	if (!validPin(pin)) return(-1);
+	lines[pin].used = true;
+#ifdef GPIO_CHARDEV
+	if (lines[pin].index >= 0) { // already held, reconfigure in place
+		int olddir = lines[pin].mode;
+		lines[pin].mode = dir;
+		struct gpio_v2_line_config config;
+		linesConfig(&config);
+		if (-1 == ioctl(requestfd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config)) {
+			fprintf(stderr, "Pi: Failed to configure GPIO %d: %s\n", pin, strerror(errno));
+			lines[pin].mode = olddir;
+			return(-1);
 		}
+		return(0);
 	}
-	close(fd);
-	return(atoi(value_str));
+#endif
+	lines[pin].mode = dir;
+#ifdef GPIO_CHARDEV
+	if (chipfd != -1 && !lines[pin].sysfs) return rerequestLines(pin);
+#endif
+	return sysfsDirection(pin, dir);
+}
+
+int GPIORead(int pin)
+{
+	int value;
+	if (-1 == GPIOReadMulti(1, &pin, &value)) return(-1);
+	return(value);
 }
 
 int GPIOWrite(int pin, int value)
 {
-	static const char s_values_str[] = "01";
+	return GPIOWriteMulti(1, &pin, &value);
+}
 
-	char path[GPIO_VALUE_MAX];
-	int fd;
-	int trialsleft=GPIO_TRIALS;
-	snprintf(path, GPIO_VALUE_MAX, "/sys/class/gpio/gpio%d/value", pin);
+int GPIOReadMulti(int n, const int *pins, int *values)
+{
+	GPIOInit();
+	for (int i = 0; i < n; i++) {
+		if (!validPin(pins[i])) return(-1);
+	}
+#ifdef GPIO_CHARDEV
+	struct gpio_v2_line_values v;
+	v.mask = 0;
+	v.bits = 0;
+	for (int i = 0; i < n; i++) {
+		if (lines[pins[i]].index >= 0) v.mask |= 1ULL << lines[pins[i]].index;
+	}
+	if (v.mask && -1 == ioctl(requestfd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v)) {
+		fprintf(stderr, "Pi: Failed to read GPIO values: %s\n", strerror(errno));
+		return(-1);
+	}
+#endif
+	for (int i = 0; i < n; i++) {
+#ifdef GPIO_CHARDEV
+		if (lines[pins[i]].index >= 0) {
+			values[i] = (v.bits >> lines[pins[i]].index) & 1 ? HIGH : LOW;
+			continue;
+		}
+#endif
+		char value_str[SYSFS_BUFFER_MAX];
+		int fd = valueFd(pins[i]);
+		if (-1 == fd) return(-1);
+		if (pread(fd, value_str, SYSFS_BUFFER_MAX, 0) < 1) {
+			fprintf(stderr, "Pi: Failed to read value from GPIO %d!\n", pins[i]);
+			return(-1);
+		}
+		values[i] = value_str[0] == '0' ? LOW : HIGH;
+	}
+	return(0);
+}
 
-	while (trialsleft>0) { 
-		fd = open(path, O_WRONLY);
-		if (-1 == fd) {
-			trialsleft--;
-			if (trialsleft==0) {
-				fprintf(stderr, "Pi: Failed to open GPIO %d for writing!\n", pin);
-				return(-1);
-			}
-			else delay(100);
-		} else {
-			trialsleft=0;
+int GPIOWriteMulti(int n, const int *pins, const int *values)
+{
+	static const char s_values_str[] = "01";
+
+	GPIOInit();
+	for (int i = 0; i < n; i++) {
+		if (!validPin(pins[i])) return(-1);
+	}
+#ifdef GPIO_CHARDEV
+	struct gpio_v2_line_values v;
+	v.mask = 0;
+	v.bits = 0;
+	for (int i = 0; i < n; i++) {
+		if (lines[pins[i]].index < 0) continue;
+		__u64 bit = 1ULL << lines[pins[i]].index;
+		v.mask |= bit;
+		if (values[i] != LOW) v.bits |= bit;
+	}
+	if (v.mask) {
+		if (-1 == ioctl(requestfd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v)) {
+			fprintf(stderr, "Pi: Failed to write GPIO values: %s\n", strerror(errno));
+			return(-1);
+		}
+		for (int i = 0; i < n; i++) {
+			if (lines[pins[i]].index >= 0) lines[pins[i]].value = values[i];
 		}
 	}
-	
-	trialsleft=GPIO_TRIALS;
-	while (trialsleft>0) { 
-		if (1 != write(fd, &s_values_str[LOW == value ? 0 : 1], 1)) {
-			trialsleft--;
-			if (trialsleft==0) {
-				fprintf(stderr, "Pi: Failed to write value to GPIO %d!\n",pin);
-				return(-1);
-			}
-			else delay(100);
-		} else {
-			trialsleft=0;
+#endif
+	for (int i = 0; i < n; i++) {
+#ifdef GPIO_CHARDEV
+		if (lines[pins[i]].index >= 0) continue;
+#endif
+		int fd = valueFd(pins[i]);
+		if (-1 == fd) return(-1);
+		if (1 != pwrite(fd, &s_values_str[LOW == values[i] ? 0 : 1], 1, 0)) {
+			fprintf(stderr, "Pi: Failed to write value to GPIO %d!\n", pins[i]);
+			return(-1);
 		}
+		lines[pins[i]].value = values[i];
 	}
-	
-	close(fd);
 	return(0);
 }
@@ -30,12 +30,21 @@
 extern "C"{
 #endif
 
+#define GPIO_MAX_PINS 64
+
+// Lines stay open once configured. The GPIO character device is used if
+// possible, sysfs otherwise. All functions return -1 on error.
 int GPIOExport(int);
 int GPIOUnexport(int);
 int GPIODirection(int, int);
 int GPIORead(int);
 int GPIOWrite(int, int);
 
+// Reads or writes n lines at once. With the character device this is a
+// single ioctl for all lines, lines on sysfs take one pread()/pwrite() each.
+int GPIOReadMulti(int n, const int *pins, int *values);
+int GPIOWriteMulti(int n, const int *pins, const int *values);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
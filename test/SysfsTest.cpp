@@ -0,0 +1,148 @@
+/*
+  SysfsTest - The GPIO backend of sysfsio.cpp against a fake sysfs tree.
+
+  Runs twice, each time in a child process because sysfsio reads its
+  environment once: with /dev/null as GPIO chip, which opens but refuses
+  every line request, so each line has to fall back to sysfs on its own,
+  and with a chip that doesn't exist, which uses sysfs from the start.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "sysfsio.h"
+
+// piduinowrapper.cpp, which holds main(), is left out, so the ports live here.
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+static char root[64];
+static int failures = 0;
+
+static void writeFile(const char *file, const char *text)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", root, file);
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fputs(text, f);
+        fclose(f);
+    }
+}
+
+static void expectFile(const char *file, const char *text, const char *what)
+{
+    char path[128], got[16] = "";
+    snprintf(path, sizeof(path), "%s/%s", root, file);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (!fgets(got, sizeof(got), f)) got[0] = '\0';
+        fclose(f);
+    }
+    got[strcspn(got, "\n")] = '\0';
+    if (strcmp(got, text) == 0) return;
+    printf("  %s: %s is \"%s\", expected \"%s\"\n", what, file, got, text);
+    failures++;
+}
+
+static void expect(bool ok, const char *what)
+{
+    if (ok) return;
+    printf("  %s failed\n", what);
+    failures++;
+}
+
+static void makeLine(int pin)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/gpio%d", root, pin);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "gpio%d/direction", pin);
+    writeFile(path, "in\n");
+    snprintf(path, sizeof(path), "gpio%d/value", pin);
+    writeFile(path, "0\n");
+}
+
+static int run(const char *chip)
+{
+    strcpy(root, "/tmp/sysfstest.XXXXXX");
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    writeFile("export", "");
+    writeFile("unexport", "");
+    makeLine(17);
+    makeLine(27);
+    makeLine(22);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/gpio23", root); // value can't be opened for writing
+    mkdir(path, 0755);
+    writeFile("gpio23/direction", "in\n");
+    snprintf(path, sizeof(path), "%s/gpio23/value", root);
+    mkdir(path, 0755);
+    setenv("PIDUINO_SYSFS_GPIO", root, 1);
+    setenv("PIDUINO_GPIOCHIP", chip, 1);
+
+    expect(GPIOExport(17) == 0 && GPIODirection(17, OUTPUT) == 0, "pinMode(17, OUTPUT)");
+    expectFile("export", "17", "export");
+    expectFile("gpio17/direction", "out", "direction");
+    expect(GPIOWrite(17, HIGH) == 0, "GPIOWrite(17, HIGH)");
+    expectFile("gpio17/value", "1", "write");
+    expect(GPIOWrite(17, LOW) == 0, "GPIOWrite(17, LOW)");
+    expectFile("gpio17/value", "0", "write");
+
+    expect(GPIOExport(27) == 0 && GPIODirection(27, INPUT) == 0, "pinMode(27, INPUT)");
+    expectFile("gpio27/direction", "in", "direction");
+    writeFile("gpio27/value", "1\n");
+    expect(GPIORead(27) == HIGH, "GPIORead(27)");
+
+    expect(GPIOExport(22) == 0 && GPIODirection(22, OUTPUT) == 0, "pinMode(22, OUTPUT)");
+    int pins[3] = { 17, 22, 27 };
+    int values[3] = { HIGH, HIGH, LOW };
+    expect(GPIOWriteMulti(2, pins, values) == 0, "GPIOWriteMulti()");
+    expectFile("gpio17/value", "1", "multi write");
+    expectFile("gpio22/value", "1", "multi write");
+    writeFile("gpio22/value", "0\n");
+    expect(GPIOReadMulti(3, pins, values) == 0, "GPIOReadMulti()");
+    expect(values[0] == HIGH && values[1] == LOW && values[2] == HIGH, "GPIOReadMulti() values");
+
+    // pinMode() again on a configured line. Unlike sysfs, the fake file isn't truncated on write
+    writeFile("gpio17/direction", "");
+    expect(GPIODirection(17, INPUT) == 0, "pinMode(17, INPUT)");
+    expectFile("gpio17/direction", "in", "direction");
+
+    // a value file that can only be read must fail instead of ignoring writes
+    expect(GPIOExport(23) == 0 && GPIODirection(23, OUTPUT) == -1, "pinMode(23, OUTPUT) on an unwritable value");
+
+    expect(GPIOUnexport(27) == 0, "GPIOUnexport(27)");
+    expectFile("unexport", "27", "unexport");
+    expect(GPIORead(17) != -1, "GPIORead(17) after unexporting 27");
+
+    snprintf(path, sizeof(path), "rm -rf %s", root);
+    if (system(path) != 0) printf("  could not remove %s\n", root);
+    return failures ? 1 : 0;
+}
+
+int main()
+{
+    const char *chips[] = { "/dev/null", "/nonexistent/gpiochip" };
+    int result = 0;
+    for (int i = 0; i < 2; i++) {
+        printf("SysfsTest: GPIO chip %s\n", chips[i]);
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) exit(run(chips[i]));
+        int status;
+        if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("SysfsTest: failed with GPIO chip %s\n", chips[i]);
+            result = 1;
+        }
+    }
+    if (result == 0) printf("SysfsTest: passed\n");
+    return result;
+}